@@ -1,253 +1,4001 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <math.h>           // pow in the zipf sampler: link with -lm
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <errno.h>
 
-#define MAX_VALUE_LEN 100
-#define HASH_SIZE 2003   
+#define MAX_VALUE_LEN 100   /* benchmark value buffers only */
+#define ARENA_MIN_SHIFT 4    /* smallest size class: 16 bytes */
+#define ARENA_MAX_SHIFT 16   /* largest size class: 64 KB, bigger values use malloc */
+#define ARENA_CLASSES (ARENA_MAX_SHIFT - ARENA_MIN_SHIFT + 1)
+#define ARENA_LARGE 0xFF     /* size class tag for malloc'd values */
+#define ARENA_SLAB_SIZE (1u << 20)
+#define HASH_MIN_SIZE 16
+#define NIL_INDEX UINT32_MAX
+#define HASH_LOAD_NUM 7      /* grow when the table passes 7/8 full */
+#define HASH_LOAD_DEN 8
+#define SKETCH_DEPTH 4        /* count-min rows */
+#define SKETCH_MAX_COUNT 15   /* 4-bit saturating counters */
+#define SKETCH_SAMPLE_FACTOR 10 /* age counters every 10 x capacity increments */
+#define WINDOW_PERCENT 1      /* admission window share of capacity */
+#define WHEEL_LEVELS 4        /* 4 x 8 bits of 1 ms ticks: ~49 days of range */
+#define WHEEL_BITS 8
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define NO_TIMER 0xFFFF
+#define REAPER_INTERVAL_MS 10
+#define BATCH_IN_SIZE (1 << 20)   /* batch mode input chunk */
+#define BATCH_OUT_SIZE (1 << 20)  /* initial batch reply buffer */
+#define TRACE_DEFAULT_OPS 2000000
+#define TRACE_DEFAULT_KEYS 1000000
+#define TRACE_DEFAULT_SKEW 0.99
+#define TRACE_SCAN_EVERY 20000  /* scan trace: ops between scan bursts */
+#define HIST_SUB_BITS 5         /* latency histogram: 32 sub-buckets per power of two */
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)
+#define SNAPSHOT_MAGIC "LRUSNAP"
+#define SNAPSHOT_VERSION 2      /* 1: int keys, 2: byte-string keys */
+#define SNAPSHOT_BUF_SIZE (1 << 20)
+#define PROBE_BUCKETS 16     /* probe length histogram: 1..15 slots, then 16+ */
+#define MAX_READER_THREADS 64  /* lock-free reader slots per sharded cache */
+#define READ_BUFFER_SIZE 64     /* hits buffered per reader before a recency drain */
+#define RETIRE_BATCH 64         /* deferred frees queued before reclaiming */
+#define DEFAULT_SHARDS 16
+#define BENCH_MAX_THREADS 32
+#define BENCH_OPS_PER_THREAD 1000000
+#define BENCH_GET_PERCENT 90
+#define BENCH_KEY_LEN 16        /* benchmark and trace keys: "k" + 15 digits */
+#define MAX_KEY_LEN 65535       /* keys longer than this are rejected */
+#define SERVER_BACKLOG 128
+#define SERVER_READ_SIZE (64 << 10)
+#define SERVER_MAX_EVENTS 64
+#define SERVER_MAX_KEY 250        /* memcached's key length limit */
+#define SERVER_MAX_VALUE (64 << 20)
+#define SERVER_OUT_HIGH (4 << 20) /* stop reading a client with this much unsent */
+#define LOADGEN_MAX_DEPTH 1024    /* requests in flight per load generator connection */
+#define TIER_SEGMENTS 8           /* disk tier budget split into this many log segments */
+#define TIER_MIN_SEGMENT (64 << 10)
+#define TIER_WRITE_BUF (256 << 10) /* appends batched per write to the active segment */
+#define TIER_DEFAULT_BYTES (1ULL << 30)
 
 /********************* DOUBLY LINKED LIST NODE *********************/
+// nodes live in one preallocated slab and link to each other by index
 typedef struct QueueNode {
-    int key;
-    char value[MAX_VALUE_LEN];
-    struct QueueNode *prev, *next;
+    uint64_t keyHash;           // hashKey() of the key, also kept in the index
+    uint32_t prev, next;        // slab indices, NIL_INDEX for none
+    uint32_t keyLen;            // key bytes, stored after the value's NUL
+    uint32_t valueLen;          // bytes, excluding the NUL terminator
+    uint8_t sizeClass;          // arena class of value, ARENA_LARGE if malloc'd
+    uint8_t ref;                // CLOCK reference bit, set on every hit
+    uint8_t inWindow;           // admission window entry, not yet in main
+    uint8_t arcList;            // ARC list (ARC_T1..ARC_B2); B1/B2 are key-only ghosts
+    uint16_t timerSlot;         // wheel bucket (level * WHEEL_SLOTS + slot) or NO_TIMER
+    uint32_t timerPrev, timerNext;
+    uint64_t expireAt;          // cache tick (ms) the entry dies at, 0 for never
+    char *value;                // value, NUL, then key; NULL while the slot is free
 } QueueNode;
 
+/********************* EVICTION POLICY *********************/
+typedef enum EvictionPolicy {
+    POLICY_LRU,                 // strict recency list, every hit relinks the node
+    POLICY_CLOCK,               // second chance: a hit only sets node->ref
+    POLICY_ARC                  // adaptive replacement: recency and frequency lists
+} EvictionPolicy;
+
+static const char *policyNames[] = { "lru", "clock", "arc" };
+
+// ARC lists: T1 holds keys seen once recently, T2 keys seen at least
+// twice; B1/B2 remember the keys recently evicted from each
+enum { ARC_T1, ARC_T2, ARC_B1, ARC_B2, ARC_LISTS };
+
+/********************* VALUE ARENA *********************/
+// power-of-two size classes carved out of 1 MB slabs, one free list per class
+typedef struct ValueArena {
+    char *freeLists[ARENA_CLASSES];
+    char **slabs;
+    int slabCount;
+    int slabCap;
+    char *bump;                 // unused tail of the newest slab
+    size_t bumpLeft;
+} ValueArena;
+
 /********************* HASHMAP ENTRY *********************/
+// open-addressing slot, stored inline in the table (robin-hood ordering)
+// the full key hash is kept so probes only touch a node on a likely match
 typedef struct HashEntry {
-    int key;
-    QueueNode *address;         
-    struct HashEntry *next;
+    uint64_t hash;
+    uint32_t dist;              // probe distance + 1, 0 marks an empty slot
+    uint32_t node;              // slab index of the QueueNode
 } HashEntry;
 
+/********************* FREQUENCY SKETCH *********************/
+// count-min sketch of recent access counts, halved periodically so that
+// old popularity fades
+typedef struct FrequencySketch {
+    uint8_t *counters;          // SKETCH_DEPTH rows of widthMask + 1 counters
+    uint32_t widthMask;
+    uint32_t additions;
+    uint32_t sampleSize;
+} FrequencySketch;
+
+/********************* TIMING WHEEL *********************/
+// hierarchical wheel of 1 ms ticks: level l buckets span 256^l ticks each,
+// and a bucket is re-spread one level down when the wheel reaches it
+typedef struct TimingWheel {
+    uint32_t buckets[WHEEL_LEVELS][WHEEL_SLOTS];   // node indices, NIL_INDEX when empty
+    uint32_t levelCount[WHEEL_LEVELS];
+    uint32_t count;
+    uint64_t now;               // last tick processed
+    uint64_t origin;            // monotonic ms at tick 0
+} TimingWheel;
+
+/********************* CACHE STATS *********************/
+// plain counters bumped on the hot paths; cacheStats() fills in the gauges
+// and the displacement histogram when a snapshot is taken
+typedef struct CacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t inserts;
+    uint64_t updates;
+    uint64_t evictions;         // entries removed to make room
+    uint64_t expirations;       // entries removed because their TTL ran out
+    uint64_t relinks;           // hits that moved an entry to the MRU end
+    uint64_t spills;            // evicted entries written to the disk tier
+    uint64_t tierHits;          // memory misses served (and promoted) from the disk tier, not in misses
+    uint64_t compactions;       // disk tier segments rewritten or dropped
+    uint64_t probes[PROBE_BUCKETS];       // slots inspected per hashGet
+    uint64_t displacement[PROBE_BUCKETS]; // resident keys by distance from home slot
+    uint64_t bytes;             // value memory held
+    uint64_t entries;
+    uint64_t capacity;
+    uint64_t tierBytes;         // disk tier log size, live and dead records
+    uint64_t tierEntries;
+} CacheStats;
+
+/********************* DISK TIER *********************/
+// second tier for evicted entries: an append-only log split into
+// segments, with an in-memory index from key hash to record location.
+// records are never updated in place; a promoted or overwritten entry just
+// leaves a dead record behind, reclaimed when its segment is compacted
+typedef struct TierRecord {
+    uint32_t keyLen;
+    uint32_t valueLen;
+    uint64_t expireAt;          // cache tick, 0 for no expiry
+    uint64_t keyHash;
+} TierRecord;                   // followed by the key, then the value
+
+typedef struct TierSegment {
+    int fd;
+    uint32_t id;                // file <prefix>.<id>.log, ids only grow
+    uint64_t size;              // bytes appended, including buffered ones
+    uint64_t live;              // bytes of records the index still points at
+} TierSegment;
+
+typedef struct TierEntry {
+    uint64_t hash;
+    uint64_t offset;
+    uint32_t segment;           // segment id
+    uint32_t length;            // whole record, header included
+    uint32_t dist;              // probe distance + 1, 0 marks an empty slot
+} TierEntry;
+
+typedef struct DiskTier {
+    char *prefix;
+    uint64_t maxBytes;          // disk budget over all segments
+    uint64_t segmentBytes;      // the active segment is sealed past this size
+    uint64_t bytes;
+    TierSegment *segs;          // oldest first, the last one takes appends
+    int segCount;
+    int segCap;
+    uint32_t nextId;
+    TierEntry *map;             // robin-hood, like the cache index
+    uint32_t mapMask;
+    uint32_t mapCount;
+    char *writeBuf;             // tail of the active segment not yet written
+    size_t writeLen;
+    uint64_t writeBase;         // segment offset of writeBuf[0]
+    char *readBuf;              // holds the record a get is promoting
+    size_t readCap;
+    char *compactBuf;           // one sealed segment while it is compacted
+    size_t compactCap;
+    int compacting;             // appends made by compaction must not recurse
+    uint64_t compactions;
+} DiskTier;
+
+/********************* EPOCH DOMAIN *********************/
+// epoch-based reclamation for lock-free readers: a reader publishes the
+// global epoch while it is inside a lookup, and memory retired at epoch e
+// is freed only once the global epoch reaches e + 2, i.e. after every
+// reader that could still hold a pointer to it has left
+typedef struct EpochRecord {
+    uint64_t epoch;             // epoch entered at, 0 while outside a read
+    int inUse;
+} __attribute__((aligned(64))) EpochRecord;
+
+typedef struct EpochDomain {
+    uint64_t global __attribute__((aligned(64)));
+    EpochRecord records[MAX_READER_THREADS];
+} EpochDomain;
+
 /********************* LRU CACHE STRUCT *********************/
 typedef struct LRUCache {
     int capacity;
     int size;
-    QueueNode *head; 
-    QueueNode *tail; 
-    HashEntry *map[HASH_SIZE];
+    size_t maxBytes;            // value memory budget, 0 for no limit
+    size_t bytes;               // value memory currently held
+    ValueArena arena;
+    EvictionPolicy policy;
+    uint32_t hand;              // CLOCK hand, sweeps the node slab circularly
+    FrequencySketch *sketch;    // W-TinyLFU admission, NULL when disabled
+    uint32_t winHead;           // admission window LRU list
+    uint32_t winTail;
+    int winSize;
+    int winCapacity;
+    uint32_t head; 
+    uint32_t tail; 
+    uint32_t arcHead[ARC_LISTS];    // ARC lists, unused by the other policies
+    uint32_t arcTail[ARC_LISTS];
+    int arcSize[ARC_LISTS];
+    int arcTarget;              // ARC's adaptive target size for T1 (p)
+    QueueNode *nodes;           // slab of `slabSize` nodes
+    int slabSize;               // capacity, or twice that under ARC for the ghosts
+    uint32_t freeList;          // unused slab slots, chained through next
+    HashEntry *map;             // power-of-two sized slot array
+    uint32_t mapMask;
+    uint32_t mapCount;
+    TimingWheel wheel;          // TTL expiry
+    EpochDomain *epochs;        // set when lock-free readers may be looking
+    void **retired;             // frees deferred until readers are done
+    uint64_t *retiredEpochs;
+    int retiredCount;
+    int retiredCap;
+    DiskTier *tier;             // evictions spill here when set
+    CacheStats stats;
 } LRUCache;
 
-/********************* HASH FUNCTION FOR NEGATIVE KEYS *********************/
-int hash(int key) {
-    int h = key % HASH_SIZE;
-    if (h < 0) h += HASH_SIZE;
-    return h;
+/********************* HASH FUNCTION *********************/
+// 64-bit key hash in the style of wyhash: 16 bytes per round folded with a
+// 64x64->128 multiply, short keys read as overlapping words so there is no
+// byte loop. the low bits pick the index slot, the high bits the shard
+static uint64_t hashMix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+static uint64_t hashRead64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t hashRead32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t hashKey(const char *key, size_t len) {
+    const uint64_t s0 = 0xa0761d6478bd642fULL, s1 = 0xe7037ed1a0b428dbULL;
+    const uint8_t *p = (const uint8_t*)key;
+    uint64_t seed = s0 ^ hashMix(len ^ s0, s1);
+    uint64_t a, b;
+
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (hashRead32(p) << 32) | hashRead32(p + ((len >> 3) << 2));
+            b = (hashRead32(p + len - 4) << 32) | hashRead32(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        while (i > 16) {
+            seed = hashMix(hashRead64(p) ^ s1, hashRead64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = hashRead64(p + i - 16);
+        b = hashRead64(p + i - 8);
+    }
+    return hashMix(s1 ^ len, hashMix(a ^ s1, b ^ seed));
+}
+
+/********************* ARENA SIZE CLASS *********************/
+// class that fits `bytes`, or ARENA_LARGE past the biggest class
+static uint8_t arenaClass(size_t bytes) {
+    if (bytes > ((size_t)1 << ARENA_MAX_SHIFT)) return ARENA_LARGE;
+    uint8_t c = 0;
+    while (((size_t)1 << (c + ARENA_MIN_SHIFT)) < bytes) c++;
+    return c;
+}
+
+/********************* ARENA CHUNK SIZE *********************/
+// bytes an entry needs: the value, its NUL, then the key
+static size_t entryBytes(size_t keyLen, size_t len) {
+    return len + 1 + keyLen;
+}
+
+// memory charged against the byte budget for an entry of `bytes` bytes
+static size_t arenaChunkSize(size_t bytes) {
+    uint8_t c = arenaClass(bytes);
+    return c == ARENA_LARGE ? bytes : (size_t)1 << (c + ARENA_MIN_SHIFT);
+}
+
+/********************* ARENA ALLOC *********************/
+static char* arenaAlloc(ValueArena *arena, uint8_t c) {
+    if (c == ARENA_LARGE) return NULL;
+
+    char *chunk = arena->freeLists[c];
+    if (chunk) {
+        arena->freeLists[c] = *(char**)chunk;
+        return chunk;
+    }
+
+    size_t size = (size_t)1 << (c + ARENA_MIN_SHIFT);
+    if (arena->bumpLeft < size) {
+        // hand the slab's leftover to the smaller classes before moving on
+        for (int k = ARENA_CLASSES - 1; k >= 0; k--) {
+            size_t piece = (size_t)1 << (k + ARENA_MIN_SHIFT);
+            while (arena->bumpLeft >= piece) {
+                *(char**)arena->bump = arena->freeLists[k];
+                arena->freeLists[k] = arena->bump;
+                arena->bump += piece;
+                arena->bumpLeft -= piece;
+            }
+        }
+
+        if (arena->slabCount == arena->slabCap) {
+            arena->slabCap = arena->slabCap ? arena->slabCap * 2 : 8;
+            arena->slabs = (char**)realloc(arena->slabs, sizeof(char*) * arena->slabCap);
+        }
+        arena->bump = (char*)malloc(ARENA_SLAB_SIZE);
+        arena->slabs[arena->slabCount++] = arena->bump;
+        arena->bumpLeft = ARENA_SLAB_SIZE;
+    }
+
+    chunk = arena->bump;
+    arena->bump += size;
+    arena->bumpLeft -= size;
+    return chunk;
+}
+
+/********************* ARENA FREE *********************/
+static void arenaFree(ValueArena *arena, char *chunk, uint8_t c) {
+    if (c == ARENA_LARGE) {
+        free(chunk);
+        return;
+    }
+    *(char**)chunk = arena->freeLists[c];
+    arena->freeLists[c] = chunk;
+}
+
+/********************* EPOCH ADVANCE *********************/
+// moves the global epoch on if every active reader has caught up with it
+static void tryAdvanceEpoch(EpochDomain *domain) {
+    uint64_t global = __atomic_load_n(&domain->global, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < MAX_READER_THREADS; i++) {
+        uint64_t e = __atomic_load_n(&domain->records[i].epoch, __ATOMIC_ACQUIRE);
+        if (e && e != global) return;
+    }
+    __atomic_compare_exchange_n(&domain->global, &global, global + 1, 0,
+                                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+/********************* RECLAIM RETIRED *********************/
+static void reclaimRetired(LRUCache *cache) {
+    tryAdvanceEpoch(cache->epochs);
+    uint64_t global = __atomic_load_n(&cache->epochs->global, __ATOMIC_ACQUIRE);
+
+    int kept = 0;
+    for (int i = 0; i < cache->retiredCount; i++) {
+        if (cache->retiredEpochs[i] + 2 <= global) {
+            free(cache->retired[i]);
+        } else {
+            cache->retired[kept] = cache->retired[i];
+            cache->retiredEpochs[kept] = cache->retiredEpochs[i];
+            kept++;
+        }
+    }
+    cache->retiredCount = kept;
+}
+
+/********************* DEFERRED FREE *********************/
+// frees at once unless lock-free readers are enabled, in which case the
+// block waits out two epochs on the retire list
+static void deferFree(LRUCache *cache, void *p) {
+    if (!cache->epochs) {
+        free(p);
+        return;
+    }
+
+    if (cache->retiredCount == cache->retiredCap) {
+        cache->retiredCap = cache->retiredCap ? cache->retiredCap * 2 : RETIRE_BATCH * 2;
+        cache->retired = (void**)realloc(cache->retired, sizeof(void*) * cache->retiredCap);
+        cache->retiredEpochs = (uint64_t*)realloc(cache->retiredEpochs,
+                                                  sizeof(uint64_t) * cache->retiredCap);
+    }
+    cache->retired[cache->retiredCount] = p;
+    cache->retiredEpochs[cache->retiredCount] =
+        __atomic_load_n(&cache->epochs->global, __ATOMIC_ACQUIRE);
+    cache->retiredCount++;
+
+    if (cache->retiredCount >= RETIRE_BATCH) reclaimRetired(cache);
+}
+
+/********************* NODE KEY *********************/
+static char* nodeKey(QueueNode *node) {
+    return node->value + node->valueLen + 1;
+}
+
+/********************* STORE VALUE *********************/
+// writes value, NUL and key into an existing chunk
+static void fillChunk(QueueNode *node, const char *key, size_t keyLen,
+                      const char *value, size_t len) {
+    memcpy(node->value, value, len);
+    node->value[len] = '\0';
+    node->valueLen = (uint32_t)len;
+    node->keyLen = (uint32_t)keyLen;
+    memcpy(nodeKey(node), key, keyLen);
+}
+
+// copies the entry into a chunk of the right class and charges it to the cache
+static void storeValue(LRUCache *cache, QueueNode *node, const char *key, size_t keyLen,
+                       const char *value, size_t len) {
+    size_t bytes = entryBytes(keyLen, len);
+    node->sizeClass = arenaClass(bytes);
+    node->value = (node->sizeClass == ARENA_LARGE)
+                    ? (char*)malloc(bytes)
+                    : arenaAlloc(&cache->arena, node->sizeClass);
+    fillChunk(node, key, keyLen, value, len);
+    cache->bytes += arenaChunkSize(bytes);
+}
+
+/********************* DROP VALUE *********************/
+static void dropValue(LRUCache *cache, QueueNode *node) {
+    cache->bytes -= arenaChunkSize(entryBytes(node->keyLen, node->valueLen));
+    // arena chunks are only recycled, never unmapped, so a lock-free reader
+    // racing with reuse reads stale bytes and retries; malloc'd values
+    // really go away and have to wait for those readers
+    if (node->sizeClass == ARENA_LARGE) deferFree(cache, node->value);
+    else arenaFree(&cache->arena, node->value, node->sizeClass);
+    node->value = NULL;
 }
 
 /********************* CREATE NEW QUEUE NODE *********************/
-QueueNode* createQueueNode(int key, const char *value) {
-    QueueNode *node = (QueueNode*)malloc(sizeof(QueueNode));
-    node->key = key;
-    strncpy(node->value, value, MAX_VALUE_LEN);
-    node->value[MAX_VALUE_LEN - 1] = '\0';
-    node->prev = node->next = NULL;
-    return node;
+// takes a slot from the free list; the caller guarantees one is available
+uint32_t createQueueNode(LRUCache *cache, const char *key, size_t keyLen, uint64_t h,
+                         const char *value, size_t len) {
+    uint32_t idx = cache->freeList;
+    QueueNode *node = &cache->nodes[idx];
+    cache->freeList = node->next;
+
+    node->keyHash = h;
+    storeValue(cache, node, key, keyLen, value, len);
+    node->prev = node->next = NIL_INDEX;
+    node->ref = 0;
+    node->inWindow = 0;
+    node->arcList = ARC_T1;
+    node->timerSlot = NO_TIMER;
+    node->expireAt = 0;
+    return idx;
+}
+
+/********************* RELEASE QUEUE NODE *********************/
+void releaseQueueNode(LRUCache *cache, uint32_t idx) {
+    dropValue(cache, &cache->nodes[idx]);
+    cache->nodes[idx].next = cache->freeList;
+    cache->freeList = idx;
+}
+
+/********************* HASHMAP SIZING *********************/
+// smallest power of two that holds `entries` below the load limit
+static uint32_t hashTableSize(uint32_t entries) {
+    uint32_t size = HASH_MIN_SIZE;
+    while ((uint64_t)size * HASH_LOAD_NUM / HASH_LOAD_DEN < (uint64_t)entries + 1)
+        size <<= 1;
+    return size;
+}
+
+/********************* HASHMAP PLACE *********************/
+// robin-hood insert: an entry that has probed further takes the slot
+// of a "richer" one, which keeps probe lengths short and even
+static void hashPlace(HashEntry *map, uint32_t mask, HashEntry entry) {
+    uint32_t i = (uint32_t)entry.hash & mask;
+
+    while (1) {
+        HashEntry *slot = &map[i];
+        if (!slot->dist) {
+            *slot = entry;
+            return;
+        }
+        if (slot->dist < entry.dist) {
+            HashEntry tmp = *slot;
+            *slot = entry;
+            entry = tmp;
+        }
+        i = (i + 1) & mask;
+        entry.dist++;
+    }
 }
 
-/********************* CREATE NEW HASH ENTRY *********************/
-HashEntry* createHashEntry(int key, QueueNode *addr) {
-    HashEntry *entry = (HashEntry*)malloc(sizeof(HashEntry));
-    entry->key = key;
-    entry->address = addr;
-    entry->next = NULL;
-    return entry;
+/********************* HASHMAP RESIZE *********************/
+// on a shared cache this runs inside the shard's write section
+static void hashResize(LRUCache *cache, uint32_t newSize) {
+    HashEntry *old = cache->map;
+    uint32_t oldSize = cache->mapMask + 1;
+    HashEntry *fresh = (HashEntry*)calloc(newSize, sizeof(HashEntry));
+
+    // fill the new table completely before a lock-free reader can see it
+    for (uint32_t i = 0; i < oldSize; i++) {
+        if (old[i].dist) {
+            HashEntry entry = old[i];
+            entry.dist = 1;
+            hashPlace(fresh, newSize - 1, entry);
+        }
+    }
+
+    // publish the bigger table before the bigger mask: a lock-free reader
+    // loads the mask first, so it never indexes past the table it sees
+    __atomic_store_n(&cache->map, fresh, __ATOMIC_RELEASE);
+    __atomic_store_n(&cache->mapMask, newSize - 1, __ATOMIC_RELEASE);
+    deferFree(cache, old);
 }
 
 /********************* HASHMAP GET *********************/
-QueueNode* hashGet(LRUCache *cache, int key) {
-    int h = hash(key);
-    HashEntry *entry = cache->map[h];
-    while (entry) {
-        if (entry->key == key) return entry->address;
-        entry = entry->next;
+static void recordProbe(LRUCache *cache, uint32_t dist) {
+    cache->stats.probes[dist < PROBE_BUCKETS ? dist - 1 : PROBE_BUCKETS - 1]++;
+}
+
+// `h` is hashKey(key, keyLen); the bytes are only compared on a hash match
+uint32_t hashGet(LRUCache *cache, const char *key, size_t keyLen, uint64_t h) {
+    uint32_t i = (uint32_t)h & cache->mapMask;
+    uint32_t dist = 1;
+
+    while (1) {
+        HashEntry *slot = &cache->map[i];
+        // an empty slot or a shorter probe than ours means the key is absent
+        if (slot->dist < dist) {
+            recordProbe(cache, dist);
+            return NIL_INDEX;
+        }
+        if (slot->hash == h) {
+            QueueNode *node = &cache->nodes[slot->node];
+            if (node->keyLen == keyLen && memcmp(nodeKey(node), key, keyLen) == 0) {
+                recordProbe(cache, dist);
+                return slot->node;
+            }
+        }
+        i = (i + 1) & cache->mapMask;
+        dist++;
     }
-    return NULL;
 }
 
 /********************* HASHMAP PUT *********************/
-void hashPut(LRUCache *cache, int key, QueueNode *node) {
-    int h = hash(key);
-    HashEntry *newEntry = createHashEntry(key, node);
-    newEntry->next = cache->map[h];
-    cache->map[h] = newEntry;
+void hashPut(LRUCache *cache, uint64_t h, uint32_t node) {
+    uint32_t size = cache->mapMask + 1;
+    if ((uint64_t)(cache->mapCount + 1) * HASH_LOAD_DEN > (uint64_t)size * HASH_LOAD_NUM)
+        hashResize(cache, size << 1);
+
+    HashEntry entry = { h, 1, node };
+    hashPlace(cache->map, cache->mapMask, entry);
+    cache->mapCount++;
 }
 
 /********************* HASHMAP DELETE *********************/
-void hashDelete(LRUCache *cache, int key) {
-    int h = hash(key);
-    HashEntry *entry = cache->map[h], *prev = NULL;
-
-    while (entry) {
-        if (entry->key == key) {
-            if (prev) prev->next = entry->next;
-            else cache->map[h] = entry->next;
-            free(entry);
-            return;
-        }
-        prev = entry;
-        entry = entry->next;
+// backward-shift deletion: no tombstones, so lookups never slow down.
+// the slot is found by node index, so no key bytes are compared
+void hashDelete(LRUCache *cache, uint64_t h, uint32_t node) {
+    uint32_t i = (uint32_t)h & cache->mapMask;
+    uint32_t dist = 1;
+
+    while (1) {
+        HashEntry *slot = &cache->map[i];
+        if (slot->dist < dist) return;
+        if (slot->node == node) break;
+        i = (i + 1) & cache->mapMask;
+        dist++;
+    }
+
+    uint32_t next = (i + 1) & cache->mapMask;
+    while (cache->map[next].dist > 1) {
+        cache->map[i] = cache->map[next];
+        cache->map[i].dist--;
+        i = next;
+        next = (next + 1) & cache->mapMask;
     }
+    cache->map[i].dist = 0;
+    cache->mapCount--;
+}
+
+/********************* LIST UNLINK *********************/
+// shared by the main list (head/tail) and the admission window
+static void listUnlink(LRUCache *cache, uint32_t *head, uint32_t *tail, uint32_t idx) {
+    QueueNode *nodes = cache->nodes;
+    QueueNode *node = &nodes[idx];
+
+    if (node->prev != NIL_INDEX) nodes[node->prev].next = node->next;
+    else *head = node->next;
+    if (node->next != NIL_INDEX) nodes[node->next].prev = node->prev;
+    else *tail = node->prev;
+
+    node->prev = node->next = NIL_INDEX;
+}
+
+/********************* LIST PUSH FRONT *********************/
+static void listPushFront(LRUCache *cache, uint32_t *head, uint32_t *tail, uint32_t idx) {
+    QueueNode *node = &cache->nodes[idx];
+    node->prev = NIL_INDEX;
+    node->next = *head;
+
+    if (*head != NIL_INDEX)
+        cache->nodes[*head].prev = idx;
+
+    *head = idx;
+
+    if (*tail == NIL_INDEX)
+        *tail = idx;
+}
+
+/********************* LIST PUSH BACK *********************/
+static void listPushBack(LRUCache *cache, uint32_t *head, uint32_t *tail, uint32_t idx) {
+    QueueNode *node = &cache->nodes[idx];
+    node->next = NIL_INDEX;
+    node->prev = *tail;
+
+    if (*tail != NIL_INDEX)
+        cache->nodes[*tail].next = idx;
+
+    *tail = idx;
+
+    if (*head == NIL_INDEX)
+        *head = idx;
 }
 
 /********************* MOVE NODE TO FRONT (MRU) *********************/
-void moveToFront(LRUCache *cache, QueueNode *node) {
-    if (cache->head == node) return; // already MRU
+void moveToFront(LRUCache *cache, uint32_t idx) {
+    if (cache->head == idx) return; // already MRU
 
-    // unlink
-    if (node->prev) node->prev->next = node->next;
-    if (node->next) node->next->prev = node->prev;
+    cache->stats.relinks++;
+    listUnlink(cache, &cache->head, &cache->tail, idx);
+    listPushFront(cache, &cache->head, &cache->tail, idx);
+}
 
-    // update tail if needed
-    if (cache->tail == node)
-        cache->tail = node->prev;
+/********************* FIND CLOCK VICTIM *********************/
+// sweeps the hand over the slab, clearing reference bits until it finds an
+// entry that was not hit since the last pass; `keep` and window entries
+// are never chosen
+static uint32_t findClockVictim(LRUCache *cache, uint32_t keep) {
+    uint32_t slots = (uint32_t)cache->capacity;
 
-    // place at head
-    node->prev = NULL;
-    node->next = cache->head;
+    // two full turns are enough: the first clears every bit it passes
+    for (uint32_t step = 0; step < 2 * slots; step++) {
+        uint32_t idx = cache->hand;
+        cache->hand = (cache->hand + 1 == slots) ? 0 : cache->hand + 1;
 
-    if (cache->head)
-        cache->head->prev = node;
+        QueueNode *node = &cache->nodes[idx];
+        if (!node->value || node->inWindow || idx == keep) continue;
+        if (node->ref) {
+            node->ref = 0;
+            continue;
+        }
+        return idx;
+    }
+    return NIL_INDEX;
+}
 
-    cache->head = node;
+/********************* FIND VICTIM *********************/
+// the main region's next victim under the cache policy, NIL_INDEX if none
+static uint32_t findVictim(LRUCache *cache, uint32_t keep) {
+    if (cache->policy == POLICY_CLOCK)
+        return findClockVictim(cache, keep);
 
-    if (cache->tail == NULL)
-        cache->tail = node;
+    return (cache->tail == keep) ? NIL_INDEX : cache->tail;
 }
 
-/********************* REMOVE LRU NODE *********************/
-void removeLRU(LRUCache *cache) {
-    if (!cache->tail) return;
+/********************* MONOTONIC CLOCK *********************/
+static uint64_t monotonicMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// current tick of this cache, in ms since it was created
+static uint64_t cacheNow(LRUCache *cache) {
+    return monotonicMs() - cache->wheel.origin;
+}
 
-    QueueNode *lru = cache->tail;
-    hashDelete(cache, lru->key);
+/********************* TIMER SCHEDULE *********************/
+// files the node under the lowest level whose range covers its deadline
+static void timerSchedule(LRUCache *cache, uint32_t idx) {
+    TimingWheel *wheel = &cache->wheel;
+    QueueNode *node = &cache->nodes[idx];
 
-    if (lru->prev)
-        lru->prev->next = NULL;
+    uint64_t at = node->expireAt;
+    if (at <= wheel->now) at = wheel->now + 1;
+    uint64_t delta = at - wheel->now;
 
-    cache->tail = lru->prev;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= ((uint64_t)1 << (WHEEL_BITS * (level + 1))))
+        level++;
+    // beyond the top level's range: park in its farthest bucket, the entry
+    // is re-filed against its real deadline when that bucket comes round
+    if (delta >= ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)))
+        at = wheel->now + ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)) - 1;
 
-    if (!cache->tail)
-        cache->head = NULL;
+    uint32_t slot = (uint32_t)(at >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+    uint32_t *bucket = &wheel->buckets[level][slot];
 
-    free(lru);
-    cache->size--;
+    node->timerSlot = (uint16_t)(level * WHEEL_SLOTS + slot);
+    node->timerPrev = NIL_INDEX;
+    node->timerNext = *bucket;
+    if (*bucket != NIL_INDEX) cache->nodes[*bucket].timerPrev = idx;
+    *bucket = idx;
+
+    wheel->levelCount[level]++;
+    wheel->count++;
 }
 
-/********************* ADD NODE TO FRONT *********************/
-void addToFront(LRUCache *cache, QueueNode *node) {
-    node->prev = NULL;
-    node->next = cache->head;
+/********************* TIMER CANCEL *********************/
+static void timerCancel(LRUCache *cache, uint32_t idx) {
+    QueueNode *node = &cache->nodes[idx];
+    if (node->timerSlot == NO_TIMER) return;
 
-    if (cache->head)
-        cache->head->prev = node;
+    TimingWheel *wheel = &cache->wheel;
+    int level = node->timerSlot / WHEEL_SLOTS;
+    uint32_t *bucket = &wheel->buckets[level][node->timerSlot % WHEEL_SLOTS];
 
-    cache->head = node;
+    if (node->timerPrev != NIL_INDEX) cache->nodes[node->timerPrev].timerNext = node->timerNext;
+    else *bucket = node->timerNext;
+    if (node->timerNext != NIL_INDEX) cache->nodes[node->timerNext].timerPrev = node->timerPrev;
 
-    if (cache->tail == NULL)
-        cache->tail = node;
+    node->timerSlot = NO_TIMER;
+    wheel->levelCount[level]--;
+    wheel->count--;
+}
 
-    cache->size++;
+/********************* SET EXPIRY *********************/
+static void setExpiry(LRUCache *cache, uint32_t idx, uint64_t ttlMs) {
+    timerCancel(cache, idx);
+    cache->nodes[idx].expireAt = ttlMs ? cacheNow(cache) + ttlMs : 0;
+    if (ttlMs) timerSchedule(cache, idx);
 }
 
-/********************* LRU GET *********************/
-char* get(LRUCache *cache, int key) {
-    QueueNode *node = hashGet(cache, key);
-    if (!node) return NULL;
+/********************* TIER SEGMENT LOOKUP *********************/
+// segments are few and kept in id order
+static TierSegment* tierSegment(DiskTier *t, uint32_t id) {
+    int lo = 0, hi = t->segCount - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (t->segs[mid].id == id) return &t->segs[mid];
+        if (t->segs[mid].id < id) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return NULL;
+}
 
-    moveToFront(cache, node);
-    return node->value;
+static void tierSegmentName(DiskTier *t, uint32_t id, char *buf, size_t cap) {
+    snprintf(buf, cap, "%s.%06u.log", t->prefix, id);
 }
 
-/********************* LRU PUT *********************/
-void put(LRUCache *cache, int key, const char *value) {
-    QueueNode *node = hashGet(cache, key);
-
-    if (node) {
-        // update value
-        strncpy(node->value, value, MAX_VALUE_LEN);
-        node->value[MAX_VALUE_LEN - 1] = '\0';
-        moveToFront(cache, node);
+/********************* TIER WRITE *********************/
+static int tierWriteAt(int fd, const void *buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t w = pwrite(fd, (const char*)buf + done, len - done, (off_t)(offset + done));
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        done += (size_t)w;
+    }
+    return 0;
+}
+
+static int tierReadAt(int fd, void *buf, size_t len, uint64_t offset) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t r = pread(fd, (char*)buf + done, len - done, (off_t)(offset + done));
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) return -1;
+        done += (size_t)r;
+    }
+    return 0;
+}
+
+static int tierFlush(DiskTier *t) {
+    if (t->writeLen == 0) return 0;
+    if (tierWriteAt(t->segs[t->segCount - 1].fd, t->writeBuf, t->writeLen, t->writeBase) < 0)
+        return -1;
+    t->writeBase += t->writeLen;
+    t->writeLen = 0;
+    return 0;
+}
+
+/********************* TIER OPEN SEGMENT *********************/
+static void tierRemoveSegment(DiskTier *t, int i);
+
+// seals the active segment and starts a new, empty one
+static int tierOpenSegment(DiskTier *t) {
+    if (t->segCount > 0 && tierFlush(t) < 0) return -1;
+
+    char name[4096];
+    tierSegmentName(t, t->nextId, name, sizeof(name));
+    int fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+
+    if (t->segCount == t->segCap) {
+        t->segCap = t->segCap ? t->segCap * 2 : TIER_SEGMENTS * 2;
+        t->segs = (TierSegment*)realloc(t->segs, sizeof(TierSegment) * t->segCap);
+    }
+    TierSegment *seg = &t->segs[t->segCount++];
+    seg->fd = fd;
+    seg->id = t->nextId++;
+    seg->size = seg->live = 0;
+    t->writeBase = 0;
+
+    // everything in the sealed segment may already have been promoted
+    if (t->segCount > 1 && t->segs[t->segCount - 2].live == 0)
+        tierRemoveSegment(t, t->segCount - 2);
+    return 0;
+}
+
+/********************* TIER REMOVE SEGMENT *********************/
+// closes and deletes segment i; the index must no longer point into it
+static void tierRemoveSegment(DiskTier *t, int i) {
+    char name[4096];
+    tierSegmentName(t, t->segs[i].id, name, sizeof(name));
+    close(t->segs[i].fd);
+    unlink(name);
+    t->bytes -= t->segs[i].size;
+    memmove(&t->segs[i], &t->segs[i + 1], sizeof(TierSegment) * (t->segCount - i - 1));
+    t->segCount--;
+}
+
+/********************* TIER INDEX *********************/
+static int tierFind(DiskTier *t, uint64_t h) {
+    uint32_t i = (uint32_t)h & t->mapMask;
+    for (uint32_t dist = 1; ; dist++, i = (i + 1) & t->mapMask) {
+        TierEntry *e = &t->map[i];
+        if (e->dist < dist) return -1;
+        if (e->hash == h) return (int)i;
+    }
+}
+
+// the record stops being live; a sealed segment with nothing live left is
+// deleted right away
+static void tierRelease(DiskTier *t, const TierEntry *e) {
+    TierSegment *seg = tierSegment(t, e->segment);
+    seg->live -= e->length;
+    if (seg->live == 0 && seg != &t->segs[t->segCount - 1])
+        tierRemoveSegment(t, (int)(seg - t->segs));
+}
+
+static void tierDeleteSlot(DiskTier *t, uint32_t i) {
+    // backward shift: pull followers one slot closer to home
+    uint32_t next = (i + 1) & t->mapMask;
+    while (t->map[next].dist > 1) {
+        t->map[i] = t->map[next];
+        t->map[i].dist--;
+        i = next;
+        next = (next + 1) & t->mapMask;
+    }
+    t->map[i].dist = 0;
+    t->mapCount--;
+}
+
+static void tierInsertSlot(TierEntry *map, uint32_t mask, TierEntry e) {
+    uint32_t i = (uint32_t)e.hash & mask;
+    for (e.dist = 1; ; e.dist++, i = (i + 1) & mask) {
+        if (map[i].dist == 0) {
+            map[i] = e;
+            return;
+        }
+        if (map[i].dist < e.dist) {
+            TierEntry tmp = map[i];
+            map[i] = e;
+            e = tmp;
+        }
+    }
+}
+
+// points h at a new record; the record it replaces, if any, becomes dead
+static void tierIndexPut(DiskTier *t, uint64_t h, uint32_t segment,
+                         uint64_t offset, uint32_t length) {
+    int slot = tierFind(t, h);
+    if (slot >= 0) {
+        TierEntry old = t->map[slot];
+        t->map[slot].segment = segment;
+        t->map[slot].offset = offset;
+        t->map[slot].length = length;
+        tierRelease(t, &old);
         return;
     }
 
-    // remove LRU if cache full
-    if (cache->size == cache->capacity) {
-        removeLRU(cache);
+    if ((uint64_t)(t->mapCount + 1) * HASH_LOAD_DEN > (uint64_t)(t->mapMask + 1) * HASH_LOAD_NUM) {
+        uint32_t size = (t->mapMask + 1) * 2;
+        TierEntry *map = (TierEntry*)calloc(size, sizeof(TierEntry));
+        for (uint32_t i = 0; i <= t->mapMask; i++)
+            if (t->map[i].dist) tierInsertSlot(map, size - 1, t->map[i]);
+        free(t->map);
+        t->map = map;
+        t->mapMask = size - 1;
     }
+    TierEntry e = { h, offset, segment, length, 0 };
+    tierInsertSlot(t->map, t->mapMask, e);
+    t->mapCount++;
+}
 
-    QueueNode *newNode = createQueueNode(key, value);
-    addToFront(cache, newNode);
-    hashPut(cache, key, newNode);
+// drops h from the tier; returns 1 if it was there
+static int tierForget(DiskTier *t, uint64_t h) {
+    int slot = tierFind(t, h);
+    if (slot < 0) return 0;
+    TierEntry old = t->map[slot];
+    tierDeleteSlot(t, (uint32_t)slot);
+    tierRelease(t, &old);
+    return 1;
 }
 
-/********************* CREATE CACHE *********************/
-LRUCache* createCache(int capacity) {
-    LRUCache *cache = (LRUCache*)malloc(sizeof(LRUCache));
-    cache->capacity = capacity;
-    cache->size = 0;
-    cache->head = cache->tail = NULL;
+/********************* TIER APPEND *********************/
+static void tierEnforce(DiskTier *t);
 
-    for (int i = 0; i < HASH_SIZE; i++)
-        cache->map[i] = NULL;
+// appends one record to the active segment and indexes it
+static void tierAppend(DiskTier *t, uint64_t h, const char *key, uint32_t keyLen,
+                       const char *value, uint32_t len, uint64_t expireAt) {
+    TierRecord rec = { keyLen, len, expireAt, h };
+    uint64_t length = sizeof(rec) + keyLen + len;
+    if (length > t->segmentBytes) return;       // would never fit a segment
 
-    return cache;
+    TierSegment *seg = &t->segs[t->segCount - 1];
+    if (seg->size + length > t->segmentBytes) {
+        if (tierOpenSegment(t) < 0) return;
+        seg = &t->segs[t->segCount - 1];
+    }
+    if (t->writeLen + length > TIER_WRITE_BUF && tierFlush(t) < 0) return;
+
+    uint64_t offset = seg->size;
+    if (length > TIER_WRITE_BUF) {
+        // too big to buffer: flushed above, so it can go straight out
+        if (tierWriteAt(seg->fd, &rec, sizeof(rec), offset) < 0 ||
+            tierWriteAt(seg->fd, key, keyLen, offset + sizeof(rec)) < 0 ||
+            tierWriteAt(seg->fd, value, len, offset + sizeof(rec) + keyLen) < 0)
+            return;
+        t->writeBase = offset + length;
+    } else {
+        char *p = t->writeBuf + t->writeLen;
+        memcpy(p, &rec, sizeof(rec));
+        memcpy(p + sizeof(rec), key, keyLen);
+        memcpy(p + sizeof(rec) + keyLen, value, len);
+        t->writeLen += length;
+    }
+
+    seg->size += length;
+    seg->live += length;
+    t->bytes += length;
+    tierIndexPut(t, h, seg->id, offset, (uint32_t)length);
+    if (!t->compacting) tierEnforce(t);
 }
 
-/********************* CLEANUP *********************/
-void freeCache(LRUCache *cache) {
-    // free DLL
-    QueueNode *cur = cache->head;
-    while (cur) {
-        QueueNode *next = cur->next;
-        free(cur);
-        cur = next;
+/********************* TIER READ *********************/
+// copies a whole record into dst, from the write buffer if it is not on
+// disk yet
+static int tierRead(DiskTier *t, const TierEntry *e, char *dst) {
+    TierSegment *seg = tierSegment(t, e->segment);
+    if (seg == &t->segs[t->segCount - 1] && e->offset >= t->writeBase) {
+        memcpy(dst, t->writeBuf + (e->offset - t->writeBase), e->length);
+        return 0;
     }
+    return tierReadAt(seg->fd, dst, e->length, e->offset);
+}
+
+/********************* TIER COMPACTION *********************/
+// keeps the log within maxBytes. the sealed segment with the least live
+// data is rewritten when at most half of it is live, copying its live
+// records to the active segment; when every segment is mostly live the
+// oldest one is dropped along with its entries, like an LRU eviction
+static void tierEnforce(DiskTier *t) {
+    t->compacting = 1;
+    while (t->bytes > t->maxBytes && t->segCount > 1) {
+        int victim = 0;
+        for (int i = 1; i < t->segCount - 1; i++)
+            if (t->segs[i].live * t->segs[victim].size < t->segs[victim].live * t->segs[i].size)
+                victim = i;
+        TierSegment *seg = &t->segs[victim];
+        int rewrite = seg->live * 2 <= seg->size;
+        if (!rewrite) {
+            victim = 0;
+            seg = &t->segs[0];
+        }
+
+        // a sealed segment is never larger than segmentBytes
+        if (t->compactCap < seg->size) {
+            free(t->compactBuf);
+            t->compactCap = t->segmentBytes;
+            t->compactBuf = (char*)malloc(t->compactCap);
+        }
+        uint32_t id = seg->id;
+        size_t size = (size_t)seg->size;
+        if (tierReadAt(seg->fd, t->compactBuf, size, 0) < 0) size = 0;
+
+        // a record is live iff the index still points at this exact copy
+        for (size_t off = 0; off + sizeof(TierRecord) <= size; ) {
+            TierRecord rec;
+            memcpy(&rec, t->compactBuf + off, sizeof(rec));
+            size_t length = sizeof(rec) + rec.keyLen + rec.valueLen;
+            if (off + length > size) break;
+            int slot = tierFind(t, rec.keyHash);
+            if (slot >= 0 && t->map[slot].segment == id && t->map[slot].offset == off) {
+                if (rewrite) {
+                    const char *key = t->compactBuf + off + sizeof(rec);
+                    tierAppend(t, rec.keyHash, key, rec.keyLen, key + rec.keyLen,
+                               rec.valueLen, rec.expireAt);
+                } else {
+                    tierForget(t, rec.keyHash);
+                }
+            }
+            off += length;
+        }
 
-    // free hashmap
-    for (int i = 0; i < HASH_SIZE; i++) {
-        HashEntry *entry = cache->map[i];
-        while (entry) {
-            HashEntry *next = entry->next;
-            free(entry);
-            entry = next;
+        // usually gone by now: its last live record moved out above
+        seg = tierSegment(t, id);
+        if (seg) {
+            // anything the scan could not read is lost with the segment
+            for (uint32_t i = 0; seg->live && i <= t->mapMask; ) {
+                if (t->map[i].dist && t->map[i].segment == id) tierDeleteSlot(t, i);
+                else i++;
+            }
+            tierRemoveSegment(t, (int)(seg - t->segs));
         }
+        t->compactions++;
     }
+    t->compacting = 0;
+}
 
-    free(cache);
+/********************* TIER TAKE *********************/
+// looks key up and, on a live hit, removes it from the tier and returns
+// the value (valid until the next tier read) and its expiry through the
+// out parameters
+static int tierTake(DiskTier *t, const char *key, size_t keyLen, uint64_t h, uint64_t now,
+                    const char **value, uint32_t *len, uint64_t *expireAt) {
+    int slot = tierFind(t, h);
+    if (slot < 0) return 0;
+
+    TierEntry e = t->map[slot];
+    if (t->readCap < e.length) {
+        free(t->readBuf);
+        t->readCap = e.length;
+        t->readBuf = (char*)malloc(t->readCap);
+    }
+    if (tierRead(t, &e, t->readBuf) < 0) return 0;
+
+    TierRecord rec;
+    memcpy(&rec, t->readBuf, sizeof(rec));
+    if (rec.keyLen != keyLen || memcmp(t->readBuf + sizeof(rec), key, keyLen) != 0)
+        return 0;
+
+    tierForget(t, h);
+    if (rec.expireAt && rec.expireAt <= now) return 0;
+    *value = t->readBuf + sizeof(rec) + keyLen;
+    *len = rec.valueLen;
+    *expireAt = rec.expireAt;
+    return 1;
 }
 
-/********************* MAIN DRIVER *********************/
-int main() {
-    int size;
-    printf("Enter cache capacity: ");
-    scanf("%d", &size);
+/********************* ENABLE DISK TIER *********************/
+// evicted entries are appended to <prefix>.NNNNNN.log files, using up to
+// maxBytes of disk, and a get that misses memory is served from there and
+// promoted back. the log is private to this cache and deleted with it, so
+// it does not survive a restart (snapshots cover that). returns -1 if the
+// first segment cannot be created
+int enableDiskTier(LRUCache *cache, const char *prefix, uint64_t maxBytes) {
+    if (cache->tier) return 0;
 
-    LRUCache *cache = createCache(size);
+    DiskTier *t = (DiskTier*)calloc(1, sizeof(DiskTier));
+    t->prefix = strdup(prefix);
+    t->maxBytes = maxBytes ? maxBytes : TIER_DEFAULT_BYTES;
+    t->segmentBytes = t->maxBytes / TIER_SEGMENTS;
+    if (t->segmentBytes < TIER_MIN_SEGMENT) t->segmentBytes = TIER_MIN_SEGMENT;
+    t->map = (TierEntry*)calloc(HASH_MIN_SIZE, sizeof(TierEntry));
+    t->mapMask = HASH_MIN_SIZE - 1;
+    t->writeBuf = (char*)malloc(TIER_WRITE_BUF);
 
-    char command[50];
+    if (tierOpenSegment(t) < 0) {
+        free(t->writeBuf);
+        free(t->map);
+        free(t->prefix);
+        free(t);
+        return -1;
+    }
+    cache->tier = t;
+    return 0;
+}
 
-    while (1) {
-        scanf("%s", command);
+static void freeDiskTier(DiskTier *t) {
+    while (t->segCount > 0) tierRemoveSegment(t, t->segCount - 1);
+    free(t->segs);
+    free(t->map);
+    free(t->writeBuf);
+    free(t->readBuf);
+    free(t->compactBuf);
+    free(t->prefix);
+    free(t);
+}
 
-        if (strcmp(command, "put") == 0) {
-            int key;
-            char data[MAX_VALUE_LEN];
-            scanf("%d %s", &key, data);
-            put(cache, key, data);
+/********************* SPILL NODE *********************/
+// called on eviction, before the node's value is dropped
+static void spillNode(LRUCache *cache, uint32_t idx) {
+    if (!cache->tier) return;
+    QueueNode *node = &cache->nodes[idx];
+    if (node->expireAt && node->expireAt <= cacheNow(cache)) return;
+    tierAppend(cache->tier, node->keyHash, nodeKey(node), node->keyLen,
+               node->value, node->valueLen, node->expireAt);
+    cache->stats.spills++;
+}
+
+/********************* REMOVE NODE *********************/
+// drops any resident entry, whichever list (if any) it is on
+static void removeNode(LRUCache *cache, uint32_t idx) {
+    QueueNode *node = &cache->nodes[idx];
+    hashDelete(cache, node->keyHash, idx);
+    timerCancel(cache, idx);
+
+    if (node->inWindow) {
+        listUnlink(cache, &cache->winHead, &cache->winTail, idx);
+        node->inWindow = 0;
+        cache->winSize--;
+    } else if (cache->policy == POLICY_LRU) {
+        listUnlink(cache, &cache->head, &cache->tail, idx);
+    } else if (cache->policy == POLICY_ARC) {
+        listUnlink(cache, &cache->arcHead[node->arcList], &cache->arcTail[node->arcList], idx);
+        cache->arcSize[node->arcList]--;
+    }
+
+    releaseQueueNode(cache, idx);
+    cache->size--;
+}
+
+/********************* REMOVE LRU NODE *********************/
+void removeLRU(LRUCache *cache) {
+    if (cache->tail == NIL_INDEX) return;
+    spillNode(cache, cache->tail);
+    removeNode(cache, cache->tail);
+    cache->stats.evictions++;
+}
+
+/********************* EXPIRE ENTRIES *********************/
+// advances the wheel to the current tick, cascading higher-level buckets
+// as their turn comes and dropping everything due; each entry is touched
+// at most once per level, so reclamation is O(1) per entry and never
+// walks the recency list. returns the number of entries expired
+int expireEntries(LRUCache *cache) {
+    TimingWheel *wheel = &cache->wheel;
+    uint64_t target = cacheNow(cache);
+    int expired = 0;
+
+    while (wheel->now < target) {
+        if (wheel->count == 0) {
+            wheel->now = target;
+            break;
         }
-        else if (strcmp(command, "get") == 0) {
-            int key;
-            scanf("%d", &key);
-            char *result = get(cache, key);
-            if (result) printf("%s\n", result);
-            else printf("NULL\n");
+
+        // nothing filed below `level`: skip straight to the tick where
+        // that level's next bucket cascades
+        int level = 0;
+        while (wheel->levelCount[level] == 0) level++;
+        if (level > 0) {
+            uint64_t boundary = wheel->now | (((uint64_t)1 << (WHEEL_BITS * level)) - 1);
+            if (boundary >= target) {
+                wheel->now = target;
+                break;
+            }
+            wheel->now = boundary;
+        }
+
+        uint64_t now = ++wheel->now;
+
+        // cascade from the highest level whose index just rolled over
+        int top = 0;
+        while (top < WHEEL_LEVELS - 1 &&
+               ((now >> (WHEEL_BITS * (top + 1))) << (WHEEL_BITS * (top + 1))) == now)
+            top++;
+        for (int level = top; level >= 1; level--) {
+            uint32_t slot = (uint32_t)(now >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1);
+            uint32_t idx = wheel->buckets[level][slot];
+            wheel->buckets[level][slot] = NIL_INDEX;
+            while (idx != NIL_INDEX) {
+                uint32_t next = cache->nodes[idx].timerNext;
+                cache->nodes[idx].timerSlot = NO_TIMER;
+                wheel->levelCount[level]--;
+                wheel->count--;
+                timerSchedule(cache, idx);
+                idx = next;
+            }
+        }
+
+        uint32_t slot = (uint32_t)now & (WHEEL_SLOTS - 1);
+        uint32_t idx = wheel->buckets[0][slot];
+        while (idx != NIL_INDEX) {
+            uint32_t next = cache->nodes[idx].timerNext;
+            if (cache->nodes[idx].expireAt <= now) {
+                removeNode(cache, idx);
+                expired++;
+            }
+            idx = next;
+        }
+    }
+    cache->stats.expirations += expired;
+    return expired;
+}
+
+/********************* ARC GHOSTS *********************/
+// a ghost keeps only its key, in a chunk that is not charged to the byte
+// budget, and stays in the index so a returning key can be recognised
+static int isGhost(QueueNode *node) {
+    return node->arcList >= ARC_B1;
+}
+
+static void arcMove(LRUCache *cache, uint32_t idx, int list) {
+    QueueNode *node = &cache->nodes[idx];
+    listUnlink(cache, &cache->arcHead[node->arcList], &cache->arcTail[node->arcList], idx);
+    cache->arcSize[node->arcList]--;
+    node->arcList = (uint8_t)list;
+    listPushFront(cache, &cache->arcHead[list], &cache->arcTail[list], idx);
+    cache->arcSize[list]++;
+}
+
+// frees a ghost's key chunk, leaving the slot for reuse by the caller
+static void arcFreeGhostKey(LRUCache *cache, QueueNode *node) {
+    if (node->sizeClass == ARENA_LARGE) deferFree(cache, node->value);
+    else arenaFree(&cache->arena, node->value, node->sizeClass);
+    node->value = NULL;
+}
+
+// forgets the least recent key of ghost list B1 or B2
+static void arcDropGhost(LRUCache *cache, int list) {
+    uint32_t idx = cache->arcTail[list];
+    if (idx == NIL_INDEX) return;
+
+    QueueNode *node = &cache->nodes[idx];
+    hashDelete(cache, node->keyHash, idx);
+    listUnlink(cache, &cache->arcHead[list], &cache->arcTail[list], idx);
+    cache->arcSize[list]--;
+    arcFreeGhostKey(cache, node);
+    node->next = cache->freeList;
+    cache->freeList = idx;
+}
+
+/********************* ARC REPLACE *********************/
+// evicts the LRU entry of T1 while T1 is over its target p (or at it,
+// when the request hit B2), otherwise of T2; the victim's value is freed
+// and its key becomes a ghost in B1/B2. `keep` is never chosen.
+// returns 0 if nothing could be evicted
+static int arcReplace(LRUCache *cache, int hitB2, uint32_t keep) {
+    int t1 = cache->arcSize[ARC_T1];
+    int fromT1 = t1 > 0 && (t1 > cache->arcTarget || (hitB2 && t1 == cache->arcTarget));
+
+    uint32_t victim = NIL_INDEX;
+    for (int attempt = 0; attempt < 2 && victim == NIL_INDEX; attempt++, fromT1 = !fromT1) {
+        victim = cache->arcTail[fromT1 ? ARC_T1 : ARC_T2];
+        if (keep != NIL_INDEX && victim == keep) victim = cache->nodes[victim].prev;
+    }
+    if (victim == NIL_INDEX) return 0;
+
+    QueueNode *node = &cache->nodes[victim];
+    uint8_t c = arenaClass(entryBytes(node->keyLen, 0));
+    char *chunk = (c == ARENA_LARGE) ? (char*)malloc(entryBytes(node->keyLen, 0))
+                                     : arenaAlloc(&cache->arena, c);
+    chunk[0] = '\0';
+    memcpy(chunk + 1, nodeKey(node), node->keyLen);
+
+    spillNode(cache, victim);
+    timerCancel(cache, victim);
+    node->expireAt = 0;
+    dropValue(cache, node);
+    node->value = chunk;
+    node->valueLen = 0;
+    node->sizeClass = c;
+
+    arcMove(cache, victim, node->arcList == ARC_T1 ? ARC_B1 : ARC_B2);
+    cache->size--;
+    cache->stats.evictions++;
+    return 1;
+}
+
+/********************* ARC INSERT *********************/
+// the miss half of ARC (Megiddo & Modha, FAST '03): a key remembered in
+// B1 grows the target for T1, one remembered in B2 shrinks it, and either
+// way the key comes back straight into T2. a new key goes to T1 after
+// the ghost lists are trimmed to keep |T1|+|B1| <= c and the total <= 2c
+static uint32_t arcInsert(LRUCache *cache, const char *key, size_t keyLen, uint64_t h,
+                          const char *value, size_t len, uint32_t ghost) {
+    int c = cache->capacity;
+    int *size = cache->arcSize;
+
+    if (ghost != NIL_INDEX) {
+        QueueNode *node = &cache->nodes[ghost];
+        int hitB2 = node->arcList == ARC_B2;
+        if (hitB2) {
+            int step = size[ARC_B1] / size[ARC_B2] > 1 ? size[ARC_B1] / size[ARC_B2] : 1;
+            cache->arcTarget = cache->arcTarget - step > 0 ? cache->arcTarget - step : 0;
+        } else {
+            int step = size[ARC_B2] / size[ARC_B1] > 1 ? size[ARC_B2] / size[ARC_B1] : 1;
+            cache->arcTarget = cache->arcTarget + step < c ? cache->arcTarget + step : c;
+        }
+        if (cache->size >= c) arcReplace(cache, hitB2, NIL_INDEX);
+
+        arcFreeGhostKey(cache, node);
+        storeValue(cache, node, key, keyLen, value, len);
+        arcMove(cache, ghost, ARC_T2);
+        cache->size++;
+        return ghost;
+    }
+
+    if (size[ARC_T1] + size[ARC_B1] >= c) {
+        if (size[ARC_T1] < c) {
+            arcDropGhost(cache, ARC_B1);
+            if (cache->size >= c) arcReplace(cache, 0, NIL_INDEX);
+        } else {
+            spillNode(cache, cache->arcTail[ARC_T1]);
+            removeNode(cache, cache->arcTail[ARC_T1]);
+            cache->stats.evictions++;
+        }
+    } else if (size[ARC_T1] + size[ARC_T2] + size[ARC_B1] + size[ARC_B2] >= c) {
+        if (size[ARC_T1] + size[ARC_T2] + size[ARC_B1] + size[ARC_B2] >= 2 * c)
+            arcDropGhost(cache, size[ARC_B2] ? ARC_B2 : ARC_B1);
+        if (cache->size >= c) arcReplace(cache, 0, NIL_INDEX);
+    }
+    // deletes and expiry can leave ghosts behind without a full cache
+    while (cache->freeList == NIL_INDEX)
+        arcDropGhost(cache, size[ARC_B1] ? ARC_B1 : ARC_B2);
+
+    uint32_t idx = createQueueNode(cache, key, keyLen, h, value, len);
+    listPushFront(cache, &cache->arcHead[ARC_T1], &cache->arcTail[ARC_T1], idx);
+    size[ARC_T1]++;
+    cache->size++;
+    hashPut(cache, h, idx);
+    return idx;
+}
+
+/********************* EVICT ONE ENTRY *********************/
+// removes the policy's victim, falling back to the window's LRU entry;
+// returns 0 if only `keep` is left
+static int evictOne(LRUCache *cache, uint32_t keep) {
+    if (cache->policy == POLICY_ARC) return arcReplace(cache, 0, keep);
+
+    uint32_t victim = findVictim(cache, keep);
+    if (victim == NIL_INDEX && cache->winTail != keep) victim = cache->winTail;
+    if (victim == NIL_INDEX) return 0;
+
+    spillNode(cache, victim);
+    removeNode(cache, victim);
+    cache->stats.evictions++;
+    return 1;
+}
+
+/********************* SKETCH HASH *********************/
+// re-mixes the key hash so sketch columns are independent of index slots
+static uint64_t sketchHash(uint64_t keyHash) {
+    uint64_t x = keyHash + 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/********************* CREATE SKETCH *********************/
+static FrequencySketch* createSketch(int capacity) {
+    FrequencySketch *sketch = (FrequencySketch*)malloc(sizeof(FrequencySketch));
+    uint32_t width = 16;
+    while (width < (uint32_t)capacity) width <<= 1;
+
+    sketch->counters = (uint8_t*)calloc((size_t)width * SKETCH_DEPTH, 1);
+    sketch->widthMask = width - 1;
+    sketch->additions = 0;
+    sketch->sampleSize = (uint32_t)(capacity > 0 ? capacity : 1) * SKETCH_SAMPLE_FACTOR;
+    return sketch;
+}
+
+/********************* SKETCH ESTIMATE *********************/
+static int sketchFrequency(FrequencySketch *sketch, uint64_t keyHash) {
+    uint64_t h = sketchHash(keyHash);
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32);
+    int freq = SKETCH_MAX_COUNT;
+
+    for (uint32_t row = 0; row < SKETCH_DEPTH; row++) {
+        uint32_t col = (h1 + row * h2) & sketch->widthMask;
+        int count = sketch->counters[row * (sketch->widthMask + 1) + col];
+        if (count < freq) freq = count;
+    }
+    return freq;
+}
+
+/********************* SKETCH INCREMENT *********************/
+// once sampleSize increments have been seen every counter is halved,
+// which keeps the sketch tracking recent popularity
+static void sketchIncrement(FrequencySketch *sketch, uint64_t keyHash) {
+    uint64_t h = sketchHash(keyHash);
+    uint32_t h1 = (uint32_t)h, h2 = (uint32_t)(h >> 32);
+
+    for (uint32_t row = 0; row < SKETCH_DEPTH; row++) {
+        uint32_t col = (h1 + row * h2) & sketch->widthMask;
+        uint8_t *count = &sketch->counters[row * (sketch->widthMask + 1) + col];
+        if (*count < SKETCH_MAX_COUNT) (*count)++;
+    }
+
+    if (++sketch->additions >= sketch->sampleSize) {
+        size_t total = (size_t)(sketch->widthMask + 1) * SKETCH_DEPTH;
+        for (size_t i = 0; i < total; i++) sketch->counters[i] >>= 1;
+        sketch->additions /= 2;
+    }
+}
+
+/********************* ENABLE ADMISSION *********************/
+// turns on W-TinyLFU in front of the policy: new keys land in a small
+// window LRU, and a key leaving the window only replaces the main
+// region's victim if the sketch says it is accessed more often.
+// must be called while the cache is still empty. ARC has its own
+// frequency list and ignores this
+void enableAdmission(LRUCache *cache) {
+    if (cache->sketch || cache->size > 0 || cache->policy == POLICY_ARC) return;
+
+    cache->sketch = createSketch(cache->capacity);
+    cache->winCapacity = cache->capacity * WINDOW_PERCENT / 100;
+    if (cache->winCapacity < 1) cache->winCapacity = 1;
+}
+
+/********************* PROMOTE FROM WINDOW *********************/
+static void promoteToMain(LRUCache *cache, uint32_t idx) {
+    listUnlink(cache, &cache->winHead, &cache->winTail, idx);
+    cache->nodes[idx].inWindow = 0;
+    cache->winSize--;
+
+    if (cache->policy == POLICY_LRU)
+        listPushFront(cache, &cache->head, &cache->tail, idx);
+    else
+        cache->nodes[idx].ref = 0;
+}
+
+/********************* DRAIN WINDOW *********************/
+// shrinks the window to `limit` entries, moving its LRU entries into the
+// main region through the admission test when the main region is full
+static void drainWindow(LRUCache *cache, int limit) {
+    int mainCapacity = cache->capacity - cache->winCapacity;
+    if (limit < 0) limit = 0;
+
+    while (cache->winSize > limit && cache->winTail != NIL_INDEX) {
+        uint32_t candidate = cache->winTail;
+
+        if (cache->size - cache->winSize < mainCapacity) {
+            promoteToMain(cache, candidate);
+            continue;
+        }
+
+        uint32_t victim = findVictim(cache, NIL_INDEX);
+        if (victim != NIL_INDEX &&
+            sketchFrequency(cache->sketch, cache->nodes[candidate].keyHash) >
+            sketchFrequency(cache->sketch, cache->nodes[victim].keyHash)) {
+            spillNode(cache, victim);
+            removeNode(cache, victim);
+            promoteToMain(cache, candidate);
+        } else {
+            spillNode(cache, candidate);
+            removeNode(cache, candidate);
+        }
+        cache->stats.evictions++;
+    }
+}
+
+/********************* RECORD A HIT *********************/
+static void touchNode(LRUCache *cache, uint32_t idx) {
+    if (cache->nodes[idx].inWindow) {
+        if (cache->winHead != idx) {
+            listUnlink(cache, &cache->winHead, &cache->winTail, idx);
+            listPushFront(cache, &cache->winHead, &cache->winTail, idx);
+        }
+    } else if (cache->policy == POLICY_CLOCK) {
+        // read-only when the bit is already set, so hot keys stay clean
+        if (!cache->nodes[idx].ref) cache->nodes[idx].ref = 1;
+    } else if (cache->policy == POLICY_ARC) {
+        // a second hit on a T1 key makes it frequent
+        if (cache->arcHead[ARC_T2] != idx) arcMove(cache, idx, ARC_T2);
+    } else {
+        moveToFront(cache, idx);
+    }
+}
+
+/********************* ADD NODE TO FRONT *********************/
+void addToFront(LRUCache *cache, uint32_t idx) {
+    listPushFront(cache, &cache->head, &cache->tail, idx);
+    cache->size++;
+}
+
+/********************* PROMOTE FROM DISK TIER *********************/
+static int putEntry(LRUCache *cache, const char *key, size_t keyLen, uint64_t h,
+                    const char *value, size_t len, uint64_t ttlMs, int access);
+
+// a memory miss found in the disk tier moves back into memory, keeping
+// what is left of its TTL. the get already counted the access, so the
+// re-insert does not count it again
+static char* promoteFromTier(LRUCache *cache, const char *key, size_t keyLen,
+                             uint64_t h, size_t *len) {
+    const char *value;
+    uint32_t valueLen;
+    uint64_t expireAt, now = cacheNow(cache);
+    if (!tierTake(cache->tier, key, keyLen, h, now, &value, &valueLen, &expireAt)) return NULL;
+    if (!putEntry(cache, key, keyLen, h, value, valueLen, expireAt ? expireAt - now : 0, 0))
+        return NULL;
+
+    uint32_t idx = hashGet(cache, key, keyLen, h);
+    cache->stats.tierHits++;
+    if (len) *len = cache->nodes[idx].valueLen;
+    return cache->nodes[idx].value;
+}
+
+/********************* LRU GET (HASHED) *********************/
+// getValue for callers that already hashed the key (e.g. to pick a shard)
+char* getValueHashed(LRUCache *cache, const char *key, size_t keyLen, uint64_t h, size_t *len) {
+    if (cache->sketch) sketchIncrement(cache->sketch, h);
+
+    uint32_t idx = hashGet(cache, key, keyLen, h);
+    if (idx == NIL_INDEX || isGhost(&cache->nodes[idx])) {
+        // a tier hit counts as tierHits only
+        char *value = cache->tier ? promoteFromTier(cache, key, keyLen, h, len) : NULL;
+        if (!value) cache->stats.misses++;
+        return value;
+    }
+
+    // lazy expiry: a stale entry is dropped on sight instead of served
+    uint64_t expireAt = cache->nodes[idx].expireAt;
+    if (expireAt && expireAt <= cacheNow(cache)) {
+        removeNode(cache, idx);
+        cache->stats.expirations++;
+        cache->stats.misses++;
+        return NULL;
+    }
+
+    cache->stats.hits++;
+    touchNode(cache, idx);
+    if (len) *len = cache->nodes[idx].valueLen;
+    return cache->nodes[idx].value;
+}
+
+/********************* LRU GET (SIZED) *********************/
+// like get, and also reports the value length through len when non-NULL
+char* getValue(LRUCache *cache, const char *key, size_t keyLen, size_t *len) {
+    return getValueHashed(cache, key, keyLen, hashKey(key, keyLen), len);
+}
+
+/********************* LRU GET *********************/
+char* get(LRUCache *cache, const char *key) {
+    return getValue(cache, key, strlen(key), NULL);
+}
+
+/********************* LRU PUT (HASHED) *********************/
+// ttlMs of 0 stores the entry without expiry (and clears any earlier TTL).
+// returns 0 if the entry alone is larger than the byte budget or the key
+// is longer than MAX_KEY_LEN. access is 0 for internal re-inserts, which
+// must not count towards the admission sketch
+static int putEntry(LRUCache *cache, const char *key, size_t keyLen, uint64_t h,
+                    const char *value, size_t len, uint64_t ttlMs, int access) {
+    if (cache->capacity <= 0 || keyLen > MAX_KEY_LEN) return 0;
+
+    size_t bytes = entryBytes(keyLen, len);
+    size_t need = arenaChunkSize(bytes);
+    if (cache->maxBytes && need > cache->maxBytes) return 0;
+
+    // reclaim expired entries first, they are the cheapest room to make
+    if (cache->wheel.count) expireEntries(cache);
+
+    if (cache->sketch && access) sketchIncrement(cache->sketch, h);
+
+    uint32_t idx = hashGet(cache, key, keyLen, h);
+
+    if (idx != NIL_INDEX && !isGhost(&cache->nodes[idx])) {
+        // update value, re-using the chunk when the size class is unchanged;
+        // the key moves along with the end of the value
+        QueueNode *node = &cache->nodes[idx];
+        cache->stats.updates++;
+        if (node->sizeClass != ARENA_LARGE && node->sizeClass == arenaClass(bytes)) {
+            cache->bytes -= arenaChunkSize(entryBytes(node->keyLen, node->valueLen));
+            fillChunk(node, key, keyLen, value, len);
+            cache->bytes += need;
+        } else {
+            dropValue(cache, node);
+            storeValue(cache, node, key, keyLen, value, len);
+        }
+        setExpiry(cache, idx, ttlMs);
+        touchNode(cache, idx);
+
+        // the updated node itself is never the victim
+        while (cache->maxBytes && cache->bytes > cache->maxBytes && evictOne(cache, idx))
+            ;
+        return 1;
+    }
+
+    cache->stats.inserts++;
+    if (cache->tier) tierForget(cache->tier, h);    // this write supersedes a spilled copy
+
+    if (cache->policy == POLICY_ARC) {
+        uint32_t newNode = arcInsert(cache, key, keyLen, h, value, len, idx);
+        setExpiry(cache, newNode, ttlMs);
+        while (cache->maxBytes && cache->bytes > cache->maxBytes && evictOne(cache, newNode))
+            ;
+        return 1;
+    }
+
+    if (cache->sketch) {
+        // the new key always enters the window; whoever then overflows
+        // the window has to win admission against the main victim
+        if (cache->size >= cache->capacity)
+            drainWindow(cache, cache->winSize - 1);
+        // with an empty window the room has to come from the main region
+        while (cache->size >= cache->capacity && evictOne(cache, NIL_INDEX))
+            ;
+
+        uint32_t newNode = createQueueNode(cache, key, keyLen, h, value, len);
+        setExpiry(cache, newNode, ttlMs);
+        cache->nodes[newNode].inWindow = 1;
+        listPushFront(cache, &cache->winHead, &cache->winTail, newNode);
+        cache->winSize++;
+        cache->size++;
+        hashPut(cache, h, newNode);
+
+        drainWindow(cache, cache->winCapacity);
+        while (cache->maxBytes && cache->bytes > cache->maxBytes && evictOne(cache, newNode))
+            ;
+        return 1;
+    }
+
+    // evict until both the entry count and the byte budget leave room;
+    // this also returns the victims' slots to the free list
+    while (cache->size > 0 &&
+           (cache->size >= cache->capacity ||
+            (cache->maxBytes && cache->bytes + need > cache->maxBytes))) {
+        evictOne(cache, NIL_INDEX);
+    }
+
+    uint32_t newNode = createQueueNode(cache, key, keyLen, h, value, len);
+    setExpiry(cache, newNode, ttlMs);
+    if (cache->policy == POLICY_LRU) addToFront(cache, newNode);
+    else cache->size++;
+    hashPut(cache, h, newNode);
+    return 1;
+}
+
+int putValueHashed(LRUCache *cache, const char *key, size_t keyLen, uint64_t h,
+                   const char *value, size_t len, uint64_t ttlMs) {
+    return putEntry(cache, key, keyLen, h, value, len, ttlMs, 1);
+}
+
+/********************* LRU PUT (SIZED, TTL) *********************/
+int putValueTTL(LRUCache *cache, const char *key, size_t keyLen,
+                const char *value, size_t len, uint64_t ttlMs) {
+    return putValueHashed(cache, key, keyLen, hashKey(key, keyLen), value, len, ttlMs);
+}
+
+/********************* LRU PUT (SIZED) *********************/
+int putValue(LRUCache *cache, const char *key, size_t keyLen, const char *value, size_t len) {
+    return putValueTTL(cache, key, keyLen, value, len, 0);
+}
+
+/********************* LRU PUT *********************/
+int put(LRUCache *cache, const char *key, const char *value) {
+    return putValueTTL(cache, key, strlen(key), value, strlen(value), 0);
+}
+
+/********************* LRU PUT WITH TTL *********************/
+int putTTL(LRUCache *cache, const char *key, const char *value, uint64_t ttlMs) {
+    return putValueTTL(cache, key, strlen(key), value, strlen(value), ttlMs);
+}
+
+/********************* LRU DELETE *********************/
+// returns 1 if the key was resident (an expired entry counts as absent)
+int deleteValue(LRUCache *cache, const char *key, size_t keyLen) {
+    uint64_t h = hashKey(key, keyLen);
+    uint32_t idx = hashGet(cache, key, keyLen, h);
+    int spilled = 0;
+    if ((idx == NIL_INDEX || isGhost(&cache->nodes[idx])) && cache->tier)
+        spilled = tierForget(cache->tier, h);
+    if (idx == NIL_INDEX) return spilled;
+    if (isGhost(&cache->nodes[idx])) {
+        // forget the key entirely: unlink the ghost and hand its slot back
+        QueueNode *node = &cache->nodes[idx];
+        hashDelete(cache, node->keyHash, idx);
+        listUnlink(cache, &cache->arcHead[node->arcList], &cache->arcTail[node->arcList], idx);
+        cache->arcSize[node->arcList]--;
+        arcFreeGhostKey(cache, node);
+        node->next = cache->freeList;
+        cache->freeList = idx;
+        return spilled;
+    }
+
+    uint64_t expireAt = cache->nodes[idx].expireAt;
+    int live = !(expireAt && expireAt <= cacheNow(cache));
+    removeNode(cache, idx);
+    return live;
+}
+
+/********************* CREATE CACHE *********************/
+// bounded by entry count and, when maxBytes is non-zero, by value memory
+LRUCache* createPolicyCache(int capacity, size_t maxBytes, EvictionPolicy policy) {
+    LRUCache *cache = (LRUCache*)malloc(sizeof(LRUCache));
+    if (capacity < 0) capacity = 0;
+    cache->capacity = capacity;
+    cache->size = 0;
+    cache->maxBytes = maxBytes;
+    cache->bytes = 0;
+    memset(&cache->arena, 0, sizeof(ValueArena));
+    cache->policy = policy;
+    cache->hand = 0;
+    cache->sketch = NULL;
+    cache->winHead = cache->winTail = NIL_INDEX;
+    cache->winSize = cache->winCapacity = 0;
+
+    memset(&cache->wheel, 0, sizeof(TimingWheel));
+    for (int l = 0; l < WHEEL_LEVELS; l++)
+        for (int i = 0; i < WHEEL_SLOTS; i++)
+            cache->wheel.buckets[l][i] = NIL_INDEX;
+    cache->wheel.origin = monotonicMs();
+
+    cache->epochs = NULL;
+    cache->retired = NULL;
+    cache->retiredEpochs = NULL;
+    cache->retiredCount = cache->retiredCap = 0;
+    cache->tier = NULL;
+    memset(&cache->stats, 0, sizeof(CacheStats));
+    cache->head = cache->tail = NIL_INDEX;
+    for (int l = 0; l < ARC_LISTS; l++) {
+        cache->arcHead[l] = cache->arcTail[l] = NIL_INDEX;
+        cache->arcSize[l] = 0;
+    }
+    cache->arcTarget = 0;
+
+    // one contiguous slab for every node the cache can ever hold,
+    // threaded into a free list so put/removeLRU never touch malloc.
+    // ARC also keeps up to `capacity` ghosts in the slab
+    int slabSize = (policy == POLICY_ARC) ? capacity * 2 : capacity;
+    cache->slabSize = slabSize;
+    cache->nodes = (QueueNode*)malloc(sizeof(QueueNode) * (slabSize > 0 ? slabSize : 1));
+    for (int i = 0; i < slabSize; i++) {
+        cache->nodes[i].next = (i + 1 < slabSize) ? (uint32_t)(i + 1) : NIL_INDEX;
+        cache->nodes[i].value = NULL;
+    }
+    cache->freeList = slabSize > 0 ? 0 : NIL_INDEX;
+
+    // sized for the full slab up front, so a steady-state cache never rehashes
+    uint32_t tableSize = hashTableSize((uint32_t)slabSize);
+    cache->map = (HashEntry*)calloc(tableSize, sizeof(HashEntry));
+    cache->mapMask = tableSize - 1;
+    cache->mapCount = 0;
+
+    return cache;
+}
+
+LRUCache* createBoundedCache(int capacity, size_t maxBytes) {
+    return createPolicyCache(capacity, maxBytes, POLICY_LRU);
+}
+
+LRUCache* createCache(int capacity) {
+    return createBoundedCache(capacity, 0);
+}
+
+/********************* CACHE STATS SNAPSHOT *********************/
+// copies the counters and fills in the gauges; the displacement histogram
+// walks the whole index, so a clustered key set (e.g. keys that all land
+// on a few home slots) shows up as a long tail even before lookups do
+void cacheStats(LRUCache *cache, CacheStats *out) {
+    *out = cache->stats;
+    out->bytes = cache->bytes;
+    out->entries = (uint64_t)cache->size;
+    out->capacity = (uint64_t)(cache->capacity > 0 ? cache->capacity : 0);
+    if (cache->tier) {
+        out->compactions = cache->tier->compactions;
+        out->tierBytes = cache->tier->bytes;
+        out->tierEntries = cache->tier->mapCount;
+    }
+
+    memset(out->displacement, 0, sizeof(out->displacement));
+    for (uint32_t i = 0; i <= cache->mapMask; i++) {
+        uint32_t dist = cache->map[i].dist;
+        if (dist) out->displacement[dist < PROBE_BUCKETS ? dist - 1 : PROBE_BUCKETS - 1]++;
+    }
+}
+
+/********************* CLEANUP *********************/
+void freeCache(LRUCache *cache) {
+    // large values are the only per-entry allocations left
+    for (int i = 0; i < cache->slabSize; i++) {
+        if (cache->nodes[i].value && cache->nodes[i].sizeClass == ARENA_LARGE)
+            free(cache->nodes[i].value);
+    }
+
+    for (int i = 0; i < cache->arena.slabCount; i++)
+        free(cache->arena.slabs[i]);
+    free(cache->arena.slabs);
+
+    if (cache->sketch) {
+        free(cache->sketch->counters);
+        free(cache->sketch);
+    }
+
+    for (int i = 0; i < cache->retiredCount; i++)
+        free(cache->retired[i]);
+    free(cache->retired);
+    free(cache->retiredEpochs);
+
+    if (cache->tier) freeDiskTier(cache->tier);
+
+    // nodes and hashmap are single allocations
+    free(cache->nodes);
+    free(cache->map);
+
+    free(cache);
+}
+
+/********************* SNAPSHOT FORMAT *********************/
+// header, then `count` records of { uint32 keyLen, uint32 valueLen,
+// uint64 ttl ms left (0 = none), key bytes, value bytes } from MRU to LRU.
+// version 1 records had an int32 key in place of keyLen and no key bytes;
+// those keys load as their decimal text, which is what the driver uses
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t count;
+} SnapshotHeader;
+
+static int writeSnapshotRecord(LRUCache *cache, FILE *f, uint32_t idx, uint64_t now) {
+    QueueNode *node = &cache->nodes[idx];
+    if (node->expireAt && node->expireAt <= now) return 0;
+
+    uint64_t ttl = node->expireAt ? node->expireAt - now : 0;
+    fwrite(&node->keyLen, sizeof(node->keyLen), 1, f);
+    fwrite(&node->valueLen, sizeof(node->valueLen), 1, f);
+    fwrite(&ttl, sizeof(ttl), 1, f);
+    fwrite(nodeKey(node), 1, node->keyLen, f);
+    fwrite(node->value, 1, node->valueLen, f);
+    return 1;
+}
+
+/********************* SAVE SNAPSHOT *********************/
+// writes live entries in recency order to path.tmp and renames it over
+// path, so a crash mid-save never leaves a torn snapshot behind.
+// CLOCK has no recency order: referenced entries are written first.
+// returns the number of entries saved, or -1 on I/O error
+long saveCache(LRUCache *cache, const char *path) {
+    char tmpPath[4096];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+
+    FILE *f = fopen(tmpPath, "wb");
+    if (!f) return -1;
+    setvbuf(f, NULL, _IOFBF, SNAPSHOT_BUF_SIZE);
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    fwrite(&header, sizeof(header), 1, f);
+
+    uint64_t now = cacheNow(cache);
+    uint64_t count = 0;
+
+    // the admission window holds the most recently inserted keys
+    for (uint32_t i = cache->winHead; i != NIL_INDEX; i = cache->nodes[i].next)
+        count += writeSnapshotRecord(cache, f, i, now);
+
+    if (cache->policy == POLICY_LRU) {
+        for (uint32_t i = cache->head; i != NIL_INDEX; i = cache->nodes[i].next)
+            count += writeSnapshotRecord(cache, f, i, now);
+    } else if (cache->policy == POLICY_ARC) {
+        // ghosts are not saved; recent keys first, then the frequent ones
+        for (int l = ARC_T1; l <= ARC_T2; l++)
+            for (uint32_t i = cache->arcHead[l]; i != NIL_INDEX; i = cache->nodes[i].next)
+                count += writeSnapshotRecord(cache, f, i, now);
+    } else {
+        for (int pass = 1; pass >= 0; pass--)
+            for (uint32_t i = 0; i < (uint32_t)cache->capacity; i++)
+                if (cache->nodes[i].value && !cache->nodes[i].inWindow && cache->nodes[i].ref == pass)
+                    count += writeSnapshotRecord(cache, f, i, now);
+    }
+
+    header.count = count;
+    int ok = fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = (fflush(f) == 0) && ok;
+    ok = (fsync(fileno(f)) == 0) && ok;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(tmpPath, path) != 0) {
+        unlink(tmpPath);
+        return -1;
+    }
+    return (long)count;
+}
+
+/********************* LOAD SNAPSHOT *********************/
+// maps the snapshot and rebuilds the list and hash index in one linear
+// pass, appending each record at the LRU end so recency order survives.
+// with admission on, the most recent records fill the window and the
+// rest the main region, each up to its own capacity. the cache must be
+// empty; records beyond its capacity or byte budget (the least recent
+// ones) are skipped. returns entries loaded or -1
+long loadCache(LRUCache *cache, const char *path) {
+    if (cache->size > 0) return -1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader)) {
+        close(fd);
+        return -1;
+    }
+
+    size_t size = (size_t)st.st_size;
+    const char *map = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    posix_madvise((void*)map, size, POSIX_MADV_SEQUENTIAL);
+
+    SnapshotHeader header;
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+        header.version < 1 || header.version > SNAPSHOT_VERSION) {
+        munmap((void*)map, size);
+        return -1;
+    }
+
+    const size_t recordHead = sizeof(uint32_t) + sizeof(uint32_t) + sizeof(uint64_t);
+    size_t pos = sizeof(header);
+    long loaded = 0;
+    int winCapacity = cache->sketch ? cache->winCapacity : 0;
+
+    for (uint64_t r = 0; r < header.count && cache->size < cache->capacity; r++) {
+        if (size - pos < recordHead) break;
+
+        uint32_t keyLen, len;
+        uint64_t ttl;
+        memcpy(&keyLen, map + pos, sizeof(keyLen));
+        memcpy(&len, map + pos + 4, sizeof(len));
+        memcpy(&ttl, map + pos + 8, sizeof(ttl));
+        pos += recordHead;
+
+        const char *key;
+        char legacyKey[16];
+        if (header.version == 1) {
+            keyLen = (uint32_t)snprintf(legacyKey, sizeof(legacyKey), "%d", (int32_t)keyLen);
+            key = legacyKey;
+        } else {
+            if (keyLen > MAX_KEY_LEN || size - pos < keyLen) break;
+            key = map + pos;
+            pos += keyLen;
+        }
+        if (size - pos < len) break;
+
+        const char *value = map + pos;
+        pos += len;
+
+        size_t need = arenaChunkSize(entryBytes(keyLen, len));
+        if (cache->maxBytes && cache->bytes + need > cache->maxBytes) break;
+        uint64_t h = hashKey(key, keyLen);
+        if (hashGet(cache, key, keyLen, h) != NIL_INDEX) continue;
+
+        uint32_t idx = createQueueNode(cache, key, keyLen, h, value, len);
+        setExpiry(cache, idx, ttl);
+        if (cache->winSize < winCapacity) {
+            cache->nodes[idx].inWindow = 1;
+            listPushBack(cache, &cache->winHead, &cache->winTail, idx);
+            cache->winSize++;
+        } else if (cache->policy == POLICY_LRU) {
+            listPushBack(cache, &cache->head, &cache->tail, idx);
+        } else if (cache->policy == POLICY_ARC) {
+            listPushBack(cache, &cache->arcHead[ARC_T1], &cache->arcTail[ARC_T1], idx);
+            cache->arcSize[ARC_T1]++;
+        }
+        cache->size++;
+        hashPut(cache, h, idx);
+        loaded++;
+    }
+
+    munmap((void*)map, size);
+    return loaded;
+}
+
+/********************* SHARDED CACHE STRUCT *********************/
+// one lock per shard, padded to a cache line so shards do not false-share
+typedef struct CacheShard {
+    pthread_mutex_t lock;
+    uint32_t seq;               // odd while a writer changes the index or values
+    LRUCache *cache;
+} __attribute__((aligned(64))) CacheShard;
+
+typedef struct ShardedLRUCache {
+    EpochDomain epochs;         // lock-free reader epochs, see enableLockFreeReads
+    int lockFreeReads;
+    uint64_t readerHits;        // lock-free gets, flushed from reader handles
+    uint64_t readerMisses;
+    int shardCount;
+    CacheShard *shards;
+    pthread_t reaper;           // background expiry thread, see startExpiryReaper
+    int reaperRunning;
+    int reaperStop;
+    pthread_mutex_t reaperLock;
+    pthread_cond_t reaperWake;
+} ShardedLRUCache;
+
+/********************* SHARD ROUTING *********************/
+// uses the high half of the key hash, the index uses the low bits, so
+// the keys routed to one shard still spread over that shard's whole table
+static int shardFor(ShardedLRUCache *sc, uint64_t h) {
+    return (int)((uint32_t)(h >> 32) % (uint32_t)sc->shardCount);
+}
+
+/********************* CREATE SHARDED CACHE *********************/
+ShardedLRUCache* createShardedCache(int capacity, size_t maxBytes,
+                                    EvictionPolicy policy, int shardCount) {
+    if (shardCount < 1) shardCount = 1;
+    if (shardCount > capacity) shardCount = capacity > 0 ? capacity : 1;
+
+    ShardedLRUCache *sc = (ShardedLRUCache*)aligned_alloc(64, sizeof(ShardedLRUCache));
+    memset(&sc->epochs, 0, sizeof(EpochDomain));
+    sc->epochs.global = 1;
+    sc->lockFreeReads = 0;
+    sc->readerHits = sc->readerMisses = 0;
+    sc->shardCount = shardCount;
+    sc->reaperRunning = sc->reaperStop = 0;
+    pthread_mutex_init(&sc->reaperLock, NULL);
+    pthread_cond_init(&sc->reaperWake, NULL);
+    sc->shards = (CacheShard*)aligned_alloc(64, sizeof(CacheShard) * shardCount);
+
+    // spread capacity evenly, the first shards take the remainder
+    int base = capacity / shardCount;
+    int extra = capacity % shardCount;
+    for (int i = 0; i < shardCount; i++) {
+        pthread_mutex_init(&sc->shards[i].lock, NULL);
+        sc->shards[i].seq = 0;
+        sc->shards[i].cache = createPolicyCache(base + (i < extra ? 1 : 0),
+                                                maxBytes / shardCount, policy);
+    }
+    return sc;
+}
+
+/********************* SHARDED DISK TIER *********************/
+// one log per shard, <prefix>-<shard>.NNNNNN.log, each with an equal
+// share of maxBytes. call before the cache is shared between threads
+int enableShardedDiskTier(ShardedLRUCache *sc, const char *prefix, uint64_t maxBytes) {
+    char name[4096];
+    if (!maxBytes) maxBytes = TIER_DEFAULT_BYTES;
+    for (int i = 0; i < sc->shardCount; i++) {
+        snprintf(name, sizeof(name), "%s-%d", prefix, i);
+        if (enableDiskTier(sc->shards[i].cache, name, maxBytes / sc->shardCount) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+/********************* SHARD WRITE SECTION *********************/
+// seqlock around every change a lock-free reader could observe; called
+// with the shard lock held
+static void shardWriteBegin(CacheShard *shard) {
+    __atomic_store_n(&shard->seq, shard->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void shardWriteEnd(CacheShard *shard) {
+    __atomic_store_n(&shard->seq, shard->seq + 1, __ATOMIC_RELEASE);
+}
+
+/********************* SHARDED GET *********************/
+// copies the value out while the shard lock is held, since the node may be
+// evicted by another thread as soon as the lock is released. returns the
+// full value length (which may exceed outLen) or -1 on a miss
+long shardedGet(ShardedLRUCache *sc, const char *key, size_t keyLen, char *out, size_t outLen) {
+    uint64_t h = hashKey(key, keyLen);
+    CacheShard *shard = &sc->shards[shardFor(sc, h)];
+    long found = -1;
+
+    pthread_mutex_lock(&shard->lock);
+    shardWriteBegin(shard);     // an expired hit is removed on the spot
+    size_t len;
+    char *value = getValueHashed(shard->cache, key, keyLen, h, &len);
+    if (value) {
+        if (out && outLen > 0) {
+            size_t n = len < outLen ? len : outLen - 1;
+            memcpy(out, value, n);
+            out[n] = '\0';
+        }
+        found = (long)len;
+    }
+    shardWriteEnd(shard);
+    pthread_mutex_unlock(&shard->lock);
+
+    return found;
+}
+
+/********************* SHARDED PUT WITH TTL *********************/
+int shardedPutTTL(ShardedLRUCache *sc, const char *key, size_t keyLen,
+                  const char *value, size_t len, uint64_t ttlMs) {
+    uint64_t h = hashKey(key, keyLen);
+    CacheShard *shard = &sc->shards[shardFor(sc, h)];
+
+    pthread_mutex_lock(&shard->lock);
+    shardWriteBegin(shard);
+    int stored = putValueHashed(shard->cache, key, keyLen, h, value, len, ttlMs);
+    shardWriteEnd(shard);
+    pthread_mutex_unlock(&shard->lock);
+    return stored;
+}
+
+/********************* SHARDED PUT *********************/
+int shardedPut(ShardedLRUCache *sc, const char *key, size_t keyLen,
+               const char *value, size_t len) {
+    return shardedPutTTL(sc, key, keyLen, value, len, 0);
+}
+
+/********************* EXPIRY REAPER *********************/
+// advances every shard's timing wheel each REAPER_INTERVAL_MS, so expired
+// entries are reclaimed even on shards that see no puts
+static void* expiryReaper(void *arg) {
+    ShardedLRUCache *sc = (ShardedLRUCache*)arg;
+
+    pthread_mutex_lock(&sc->reaperLock);
+    while (!sc->reaperStop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += REAPER_INTERVAL_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_cond_timedwait(&sc->reaperWake, &sc->reaperLock, &deadline);
+        if (sc->reaperStop) break;
+        pthread_mutex_unlock(&sc->reaperLock);
+
+        for (int i = 0; i < sc->shardCount; i++) {
+            CacheShard *shard = &sc->shards[i];
+            pthread_mutex_lock(&shard->lock);
+            if (shard->cache->wheel.count) {
+                shardWriteBegin(shard);
+                expireEntries(shard->cache);
+                shardWriteEnd(shard);
+            }
+            pthread_mutex_unlock(&shard->lock);
+        }
+
+        pthread_mutex_lock(&sc->reaperLock);
+    }
+    pthread_mutex_unlock(&sc->reaperLock);
+    return NULL;
+}
+
+void startExpiryReaper(ShardedLRUCache *sc) {
+    if (sc->reaperRunning) return;
+    sc->reaperStop = 0;
+    sc->reaperRunning = (pthread_create(&sc->reaper, NULL, expiryReaper, sc) == 0);
+}
+
+void stopExpiryReaper(ShardedLRUCache *sc) {
+    if (!sc->reaperRunning) return;
+
+    pthread_mutex_lock(&sc->reaperLock);
+    sc->reaperStop = 1;
+    pthread_cond_signal(&sc->reaperWake);
+    pthread_mutex_unlock(&sc->reaperLock);
+
+    pthread_join(sc->reaper, NULL);
+    sc->reaperRunning = 0;
+}
+
+/********************* LOCK-FREE READS *********************/
+// readers look entries up without the shard lock: the shard seqlock
+// tells them to retry if a writer changed anything they read, and epochs
+// keep freed values and old hash tables alive until they are gone. hits
+// are not applied to the recency list directly but buffered per reader
+// and replayed under the lock in batches (CLOCK hits just set the bit)
+typedef struct ReadBufferEntry {
+    int shard;
+    uint32_t node;
+    uint64_t keyHash;
+} ReadBufferEntry;
+
+typedef struct ReaderHandle {
+    ShardedLRUCache *sc;
+    int slot;                   // this reader's EpochRecord
+    int count;
+    uint32_t hits;              // not yet added to the cache's counters
+    uint32_t misses;
+    ReadBufferEntry buf[READ_BUFFER_SIZE];
+} ReaderHandle;
+
+// must be called before other threads start using the cache
+void enableLockFreeReads(ShardedLRUCache *sc) {
+    for (int i = 0; i < sc->shardCount; i++)
+        sc->shards[i].cache->epochs = &sc->epochs;
+    sc->lockFreeReads = 1;
+}
+
+// one handle per reading thread; NULL if all reader slots are taken
+ReaderHandle* attachReader(ShardedLRUCache *sc) {
+    if (!sc->lockFreeReads) return NULL;
+
+    for (int i = 0; i < MAX_READER_THREADS; i++) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&sc->epochs.records[i].inUse, &expected, 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            ReaderHandle *h = (ReaderHandle*)malloc(sizeof(ReaderHandle));
+            h->sc = sc;
+            h->slot = i;
+            h->count = 0;
+            h->hits = h->misses = 0;
+            return h;
+        }
+    }
+    return NULL;
+}
+
+/********************* DRAIN READ BUFFER *********************/
+// replays buffered hits shard by shard; a shard whose lock is busy has
+// its hits dropped rather than making the reader wait
+static void drainReadBuffer(ReaderHandle *h) {
+    ShardedLRUCache *sc = h->sc;
+    char done[READ_BUFFER_SIZE] = { 0 };
+
+    for (int i = 0; i < h->count; i++) {
+        if (done[i]) continue;
+        CacheShard *shard = &sc->shards[h->buf[i].shard];
+        int locked = (pthread_mutex_trylock(&shard->lock) == 0);
+
+        for (int j = i; j < h->count; j++) {
+            if (done[j] || h->buf[j].shard != h->buf[i].shard) continue;
+            done[j] = 1;
+            if (!locked) continue;
+
+            // the slot may have been evicted and reused since the hit
+            LRUCache *cache = shard->cache;
+            QueueNode *node = &cache->nodes[h->buf[j].node];
+            if (!node->value || node->keyHash != h->buf[j].keyHash || isGhost(node)) continue;
+            if (cache->sketch) sketchIncrement(cache->sketch, node->keyHash);
+            touchNode(cache, h->buf[j].node);
+        }
+        if (locked) pthread_mutex_unlock(&shard->lock);
+    }
+    h->count = 0;
+
+    __atomic_fetch_add(&sc->readerHits, h->hits, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&sc->readerMisses, h->misses, __ATOMIC_RELAXED);
+    h->hits = h->misses = 0;
+}
+
+void detachReader(ReaderHandle *h) {
+    drainReadBuffer(h);
+    __atomic_store_n(&h->sc->epochs.records[h->slot].inUse, 0, __ATOMIC_RELEASE);
+    free(h);
+}
+
+/********************* LOCK-FREE LOOKUP *********************/
+// hashGet for readers: every shared word is loaded atomically and the
+// probe is bounded, since a concurrent writer can leave any state behind.
+// returns the first slot whose hash matches; the caller compares the key
+// once the seqlock says the node it read is consistent
+static uint32_t readerLookup(LRUCache *cache, uint64_t h) {
+    uint32_t mask = __atomic_load_n(&cache->mapMask, __ATOMIC_ACQUIRE);
+    HashEntry *map = __atomic_load_n(&cache->map, __ATOMIC_ACQUIRE);
+    uint32_t i = (uint32_t)h & mask;
+
+    for (uint32_t dist = 1; dist <= mask + 1; dist++) {
+        HashEntry *slot = &map[i];
+        if (__atomic_load_n(&slot->dist, __ATOMIC_RELAXED) < dist) return NIL_INDEX;
+        if (__atomic_load_n(&slot->hash, __ATOMIC_RELAXED) == h) {
+            uint32_t node = __atomic_load_n(&slot->node, __ATOMIC_RELAXED);
+            return node < (uint32_t)cache->slabSize ? node : NIL_INDEX;
+        }
+        i = (i + 1) & mask;
+    }
+    return NIL_INDEX;
+}
+
+/********************* LOCK-FREE GET *********************/
+// same contract as shardedGet, without taking the shard lock. two resident
+// keys with the same 64-bit hash make this path miss on one of them; the
+// locked path compares every candidate
+long concurrentGet(ReaderHandle *h, const char *key, size_t keyLen, char *out, size_t outLen) {
+    ShardedLRUCache *sc = h->sc;
+    uint64_t kh = hashKey(key, keyLen);
+    int s = shardFor(sc, kh);
+    CacheShard *shard = &sc->shards[s];
+    LRUCache *cache = shard->cache;
+    EpochRecord *rec = &sc->epochs.records[h->slot];
+    uint32_t idx;
+    long found;
+
+    __atomic_store_n(&rec->epoch, __atomic_load_n(&sc->epochs.global, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    while (1) {
+        uint32_t seq = __atomic_load_n(&shard->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue;
+
+        found = -1;
+        const char *value = NULL;
+        uint32_t len = 0;
+        idx = readerLookup(cache, kh);
+        if (idx != NIL_INDEX) {
+            QueueNode *node = &cache->nodes[idx];
+            value = __atomic_load_n(&node->value, __ATOMIC_RELAXED);
+            len = __atomic_load_n(&node->valueLen, __ATOMIC_RELAXED);
+            uint64_t expireAt = __atomic_load_n(&node->expireAt, __ATOMIC_RELAXED);
+            if (!value || __atomic_load_n(&node->arcList, __ATOMIC_RELAXED) >= ARC_B1 ||
+                __atomic_load_n(&node->keyLen, __ATOMIC_RELAXED) != keyLen ||
+                __atomic_load_n(&node->keyHash, __ATOMIC_RELAXED) != kh ||
+                (expireAt && expireAt <= cacheNow(cache)))
+                idx = NIL_INDEX;
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shard->seq, __ATOMIC_RELAXED) != seq) continue;
+        if (idx == NIL_INDEX) break;
+
+        // value, lengths and chunk were consistent at the check above, so
+        // the key bytes sit right after the value; compare and copy, then
+        // make sure the chunk was not recycled underneath us
+        int match = memcmp(value + len + 1, key, keyLen) == 0;
+        if (match && out && outLen > 0) {
+            size_t n = len < outLen ? len : outLen - 1;
+            memcpy(out, value, n);
+            out[n] = '\0';
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&shard->seq, __ATOMIC_RELAXED) != seq) continue;
+        if (match) found = (long)len;
+        else idx = NIL_INDEX;
+        break;
+    }
+
+    __atomic_store_n(&rec->epoch, 0, __ATOMIC_RELEASE);
+
+    // a memory miss may still be in the disk tier, which needs the lock
+    if (found < 0 && cache->tier) return shardedGet(sc, key, keyLen, out, outLen);
+
+    if (found < 0) {
+        if (++h->misses == READ_BUFFER_SIZE) drainReadBuffer(h);
+    } else {
+        QueueNode *node = &cache->nodes[idx];
+        h->hits++;
+        if (cache->policy == POLICY_CLOCK && !__atomic_load_n(&node->inWindow, __ATOMIC_RELAXED)) {
+            if (!__atomic_load_n(&node->ref, __ATOMIC_RELAXED))
+                __atomic_store_n(&node->ref, 1, __ATOMIC_RELAXED);
+        } else {
+            ReadBufferEntry *e = &h->buf[h->count++];
+            e->shard = s;
+            e->node = idx;
+            e->keyHash = kh;
+            if (h->count == READ_BUFFER_SIZE) drainReadBuffer(h);
+        }
+    }
+    return found;
+}
+
+/********************* SHARDED STATS *********************/
+// sums every shard, taking each lock in turn, so the result is consistent
+// per shard but not across shards
+void shardedStats(ShardedLRUCache *sc, CacheStats *out) {
+    memset(out, 0, sizeof(CacheStats));
+
+    for (int i = 0; i < sc->shardCount; i++) {
+        CacheStats st;
+        pthread_mutex_lock(&sc->shards[i].lock);
+        cacheStats(sc->shards[i].cache, &st);
+        pthread_mutex_unlock(&sc->shards[i].lock);
+
+        out->hits += st.hits;
+        out->misses += st.misses;
+        out->inserts += st.inserts;
+        out->updates += st.updates;
+        out->evictions += st.evictions;
+        out->expirations += st.expirations;
+        out->relinks += st.relinks;
+        out->spills += st.spills;
+        out->tierHits += st.tierHits;
+        out->compactions += st.compactions;
+        out->tierBytes += st.tierBytes;
+        out->tierEntries += st.tierEntries;
+        out->bytes += st.bytes;
+        out->entries += st.entries;
+        out->capacity += st.capacity;
+        for (int b = 0; b < PROBE_BUCKETS; b++) {
+            out->probes[b] += st.probes[b];
+            out->displacement[b] += st.displacement[b];
+        }
+    }
+    out->hits += __atomic_load_n(&sc->readerHits, __ATOMIC_RELAXED);
+    out->misses += __atomic_load_n(&sc->readerMisses, __ATOMIC_RELAXED);
+}
+
+/********************* SHARDED CLEANUP *********************/
+void freeShardedCache(ShardedLRUCache *sc) {
+    stopExpiryReaper(sc);
+    pthread_mutex_destroy(&sc->reaperLock);
+    pthread_cond_destroy(&sc->reaperWake);
+
+    for (int i = 0; i < sc->shardCount; i++) {
+        pthread_mutex_destroy(&sc->shards[i].lock);
+        freeCache(sc->shards[i].cache);
+    }
+    free(sc->shards);
+    free(sc);
+}
+
+/********************* BENCHMARK *********************/
+typedef struct BenchWorker {
+    ShardedLRUCache *cache;
+    ReaderHandle *reader;       // lock-free gets when set
+    const char *keys;           // keySpace keys of BENCH_KEY_LEN bytes
+    int keySpace;
+    uint64_t seed;
+    long hits;
+} BenchWorker;
+
+static uint64_t xorshift64(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// fixed-width key for integer id: "k" and 15 zero-padded digits, no NUL
+static void benchKey(char *buf, long id) {
+    buf[0] = 'k';
+    for (int i = BENCH_KEY_LEN - 1; i > 0; i--) {
+        buf[i] = (char)('0' + id % 10);
+        id /= 10;
+    }
+}
+
+// keys for ids 0..count-1, back to back
+static char* benchKeys(long count) {
+    char *keys = (char*)malloc((size_t)count * BENCH_KEY_LEN);
+    for (long i = 0; i < count; i++) benchKey(keys + i * BENCH_KEY_LEN, i);
+    return keys;
+}
+
+static void* benchWorker(void *arg) {
+    BenchWorker *w = (BenchWorker*)arg;
+    char value[MAX_VALUE_LEN];
+    char buf[MAX_VALUE_LEN];
+
+    for (long i = 0; i < BENCH_OPS_PER_THREAD; i++) {
+        uint64_t r = xorshift64(&w->seed);
+        int id = (int)((r >> 8) % (uint64_t)w->keySpace);
+        const char *key = w->keys + (size_t)id * BENCH_KEY_LEN;
+
+        if ((int)(r & 0x7f) * 100 < BENCH_GET_PERCENT * 128) {
+            long found = w->reader ? concurrentGet(w->reader, key, BENCH_KEY_LEN, buf, sizeof(buf))
+                                   : shardedGet(w->cache, key, BENCH_KEY_LEN, buf, sizeof(buf));
+            if (found >= 0) w->hits++;
+        } else {
+            int len = snprintf(value, sizeof(value), "v%d", id);
+            shardedPut(w->cache, key, BENCH_KEY_LEN, value, (size_t)len);
+        }
+    }
+    return NULL;
+}
+
+// mixed get/put workload over keySpace keys (twice the capacity by
+// default), run at 1..32 threads against a global-lock cache, the sharded
+// one, and the sharded one with lock-free gets
+static void runBenchmark(int capacity, int shardCount, EvictionPolicy policy, int keySpace) {
+    const int shardConfigs[3] = { 1, shardCount, shardCount };
+    const int lockFree[3] = { 0, 0, 1 };
+
+    printf("capacity=%d keys=%d ops/thread=%d get%%=%d policy=%s\n",
+           capacity, keySpace, BENCH_OPS_PER_THREAD, BENCH_GET_PERCENT,
+           policyNames[policy]);
+    printf("%-10s %-8s %-8s %-14s %-8s\n", "mode", "shards", "threads", "ops/sec", "hit%");
+
+    char *keys = benchKeys(keySpace > capacity ? keySpace : capacity);
+    for (int c = 0; c < 3; c++) {
+        for (int threads = 1; threads <= BENCH_MAX_THREADS; threads *= 2) {
+            ShardedLRUCache *sc = createShardedCache(capacity, 0, policy, shardConfigs[c]);
+            if (lockFree[c]) enableLockFreeReads(sc);
+            pthread_t tids[BENCH_MAX_THREADS];
+            BenchWorker workers[BENCH_MAX_THREADS];
+
+            // prefill so the run measures steady state, not warm-up
+            for (int k = 0; k < capacity; k++)
+                shardedPut(sc, keys + (size_t)k * BENCH_KEY_LEN, BENCH_KEY_LEN, "warm", 4);
+
+            double start = nowSeconds();
+            for (int t = 0; t < threads; t++) {
+                workers[t].cache = sc;
+                workers[t].reader = lockFree[c] ? attachReader(sc) : NULL;
+                workers[t].keys = keys;
+                workers[t].keySpace = keySpace;
+                workers[t].seed = 0x9e3779b97f4a7c15ULL * (uint64_t)(t + 1);
+                workers[t].hits = 0;
+                pthread_create(&tids[t], NULL, benchWorker, &workers[t]);
+            }
+
+            long hits = 0;
+            for (int t = 0; t < threads; t++) {
+                pthread_join(tids[t], NULL);
+                hits += workers[t].hits;
+                if (workers[t].reader) detachReader(workers[t].reader);
+            }
+            double elapsed = nowSeconds() - start;
+
+            double totalOps = (double)threads * BENCH_OPS_PER_THREAD;
+            printf("%-10s %-8d %-8d %-14.0f %-8.2f\n", lockFree[c] ? "lock-free" : "locked",
+                   sc->shardCount, threads,
+                   totalOps / elapsed,
+                   100.0 * hits / (totalOps * BENCH_GET_PERCENT / 100.0));
+
+            freeShardedCache(sc);
+        }
+    }
+    free(keys);
+}
+
+/********************* SCAN POLLUTION BENCHMARK *********************/
+// a hot set of half the capacity, interrupted every few thousand ops by a
+// one-off sequential scan over twice the capacity of never-reused keys.
+// each access is a get, followed by a put on a miss
+static double scanHitRatio(int capacity, EvictionPolicy policy, int admission, long ops) {
+    LRUCache *cache = createPolicyCache(capacity, 0, policy);
+    if (admission) enableAdmission(cache);
+
+    uint64_t seed = 0x2545f4914f6cdd1dULL;
+    int hotKeys = capacity / 2 > 0 ? capacity / 2 : 1;
+    long nextScanKey = 1L << 30;
+    long hits = 0, lookups = 0;
+    char key[BENCH_KEY_LEN];
+
+    for (long i = 0; i < ops; i++) {
+        if (i % 5000 == 4999) {
+            for (int k = 0; k < capacity * 2; k++, nextScanKey++) {
+                benchKey(key, nextScanKey);
+                if (!getValue(cache, key, BENCH_KEY_LEN, NULL))
+                    putValue(cache, key, BENCH_KEY_LEN, "scan", 4);
+            }
+        }
+
+        benchKey(key, (long)(xorshift64(&seed) % (uint64_t)hotKeys));
+        lookups++;
+        if (getValue(cache, key, BENCH_KEY_LEN, NULL)) hits++;
+        else putValue(cache, key, BENCH_KEY_LEN, "hot", 3);
+    }
+
+    freeCache(cache);
+    return 100.0 * hits / lookups;
+}
+
+static void runScanBenchmark(int capacity) {
+    const long ops = 2000000;
+
+    printf("capacity=%d hot set=%d scan=%d keys every 5000 ops\n",
+           capacity, capacity / 2, capacity * 2);
+    printf("%-8s %-10s %-8s\n", "policy", "admission", "hit%");
+    for (int policy = POLICY_LRU; policy <= POLICY_ARC; policy++) {
+        for (int admission = 0; admission <= (policy == POLICY_ARC ? 0 : 1); admission++) {
+            printf("%-8s %-10s %-8.2f\n", policyNames[policy],
+                   admission ? "tinylfu" : "none",
+                   scanHitRatio(capacity, (EvictionPolicy)policy, admission, ops));
+        }
+    }
+}
+
+/********************* KEY LOOKUP BENCHMARK *********************/
+// hit latency of getValue for 16..64 byte keys: a common prefix padded in
+// front of the id, so every lookup compares the whole key
+static void runKeyBenchmark(int entries) {
+    const int keyLens[] = { 16, 32, 64 };
+    const long ops = 4000000;
+    uint64_t seed = 0x2545f4914f6cdd1dULL;
+    long *order = (long*)malloc(sizeof(long) * ops);
+    for (long i = 0; i < ops; i++) order[i] = (long)(xorshift64(&seed) % (uint64_t)entries);
+
+    printf("entries=%d lookups=%ld\n", entries, ops);
+    printf("%-8s %-10s\n", "keylen", "ns/get");
+    for (size_t k = 0; k < sizeof(keyLens) / sizeof(keyLens[0]); k++) {
+        int len = keyLens[k];
+        char *keys = (char*)malloc((size_t)entries * len);
+        LRUCache *cache = createCache(entries);
+        for (int i = 0; i < entries; i++) {
+            char *key = keys + (size_t)i * len;
+            memset(key, 'p', len - BENCH_KEY_LEN);
+            benchKey(key + len - BENCH_KEY_LEN, i);
+            putValue(cache, key, len, "v", 1);
+        }
+
+        size_t sink = 0;
+        double start = nowSeconds();
+        for (long i = 0; i < ops; i++) {
+            size_t n = 0;
+            getValue(cache, keys + (size_t)order[i] * len, len, &n);
+            sink += n;
+        }
+        double elapsed = nowSeconds() - start;
+        printf("%-8d %-10.1f\n", len, elapsed * 1e9 / ops);
+        if (sink != (size_t)ops) fprintf(stderr, "unexpected misses\n");
+
+        freeCache(cache);
+        free(keys);
+    }
+    free(order);
+}
+
+/********************* TRACE GENERATION *********************/
+typedef enum TraceKind {
+    TRACE_UNIFORM,              // every key equally likely
+    TRACE_ZIPF,                 // skewed popularity, rank r has weight 1 / r^skew
+    TRACE_SCAN,                 // zipf traffic broken up by long sequential scans
+    TRACE_LOOP,                 // the same key range cycled in order
+    TRACE_FILE                  // keys replayed from a file
+} TraceKind;
+
+static const char *traceNames[] = { "uniform", "zipf", "scan", "loop", "file" };
+
+// zipfian sampler after Gray et al., "Quickly generating billion-record
+// synthetic databases": O(n) setup, O(1) per sample
+typedef struct ZipfGen {
+    long n;
+    double theta, alpha, zetan, eta;
+} ZipfGen;
+
+static void zipfInit(ZipfGen *z, long n, double theta) {
+    double zeta2 = 1.0 + pow(0.5, theta);
+    z->n = n;
+    z->theta = theta;
+    z->zetan = 0;
+    for (long i = 1; i <= n; i++) z->zetan += 1.0 / pow((double)i, theta);
+    z->alpha = 1.0 / (1.0 - theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+static long zipfNext(ZipfGen *z, uint64_t *seed) {
+    double u = (double)(xorshift64(seed) >> 11) / 9007199254740992.0;
+    double uz = u * z->zetan;
+    if (uz < 1.0) return 0;
+    if (uz < 1.0 + pow(0.5, z->theta)) return 1;
+    long r = (long)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return r < z->n ? r : z->n - 1;
+}
+
+// loop traces cycle over loopKeys keys; scan traces insert a sequential
+// burst of keySpace / 10 fresh keys every TRACE_SCAN_EVERY zipf accesses
+static int* generateTrace(TraceKind kind, long ops, long keySpace, double skew, long loopKeys) {
+    int *keys = (int*)malloc(sizeof(int) * ops);
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    ZipfGen zipf;
+
+    if (kind == TRACE_ZIPF || kind == TRACE_SCAN) zipfInit(&zipf, keySpace, skew);
+
+    long scanKey = keySpace;
+    for (long i = 0; i < ops; i++) {
+        switch (kind) {
+        case TRACE_UNIFORM:
+            keys[i] = (int)(xorshift64(&seed) % (uint64_t)keySpace);
+            break;
+        case TRACE_ZIPF:
+            keys[i] = (int)zipfNext(&zipf, &seed);
+            break;
+        case TRACE_SCAN:
+            if (i % TRACE_SCAN_EVERY == TRACE_SCAN_EVERY - 1) {
+                for (long b = keySpace / 10; b > 0 && i < ops; b--, i++)
+                    keys[i] = (int)(scanKey++ % INT32_MAX);
+                i--;
+            } else {
+                keys[i] = (int)zipfNext(&zipf, &seed);
+            }
+            break;
+        default:
+            keys[i] = (int)(i % loopKeys);
+            break;
+        }
+    }
+    return keys;
+}
+
+// trace keys back to back: key i is text[offsets[i]] up to offsets[i + 1]
+typedef struct TraceKeys {
+    char *text;
+    size_t *offsets;            // ops + 1 entries
+    long ops;
+} TraceKeys;
+
+// generated ids become fixed-width string keys, outside the timed loops
+static void traceFromIds(TraceKeys *t, int *ids, long ops) {
+    t->text = (char*)malloc((size_t)ops * BENCH_KEY_LEN);
+    t->offsets = (size_t*)malloc(sizeof(size_t) * (ops + 1));
+    t->ops = ops;
+    for (long i = 0; i < ops; i++) {
+        benchKey(t->text + (size_t)i * BENCH_KEY_LEN, (long)(uint32_t)ids[i]);
+        t->offsets[i] = (size_t)i * BENCH_KEY_LEN;
+    }
+    t->offsets[ops] = (size_t)ops * BENCH_KEY_LEN;
+    free(ids);
+}
+
+// one key per line, taken as a byte string: the first whitespace-delimited
+// token, or the one after it when the line starts with a command name, so
+// "get user:42" style command traces replay as well. returns -1 if the
+// file cannot be read
+static int loadTrace(const char *path, TraceKeys *t) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+
+    long cap = 1 << 16, n = 0;
+    size_t textCap = 1 << 20, used = 0;
+    t->text = (char*)malloc(textCap);
+    t->offsets = (size_t*)malloc(sizeof(size_t) * (cap + 1));
+    char *line = NULL;
+    size_t lineCap = 0;
+    while (getline(&line, &lineCap, f) >= 0) {
+        char *key = strtok(line, " \t\r\n");
+        if (!key) continue;
+        if (strcmp(key, "get") == 0 || strcmp(key, "set") == 0 ||
+            strcmp(key, "put") == 0 || strcmp(key, "delete") == 0) {
+            char *next = strtok(NULL, " \t\r\n");
+            if (next) key = next;
+        }
+        size_t len = strlen(key);
+        if (n == cap) {
+            cap *= 2;
+            t->offsets = (size_t*)realloc(t->offsets, sizeof(size_t) * (cap + 1));
+        }
+        if (used + len > textCap) {
+            while (used + len > textCap) textCap *= 2;
+            t->text = (char*)realloc(t->text, textCap);
+        }
+        memcpy(t->text + used, key, len);
+        t->offsets[n++] = used;
+        used += len;
+    }
+    free(line);
+    fclose(f);
+    t->offsets[n] = used;
+    t->ops = n;
+    return 0;
+}
+
+/********************* LATENCY HISTOGRAM *********************/
+// log-linear buckets: exact below 32 ns, then 32 steps per power of two
+// (about 3% resolution) up to 2^63 ns
+typedef struct LatencyHist {
+    uint64_t counts[HIST_BUCKETS];
+    uint64_t total;
+} LatencyHist;
+
+static int histBucket(uint64_t ns) {
+    if (ns < (1u << HIST_SUB_BITS)) return (int)ns;
+    int exp = 63 - __builtin_clzll(ns);
+    int shift = exp - HIST_SUB_BITS;
+    int sub = (int)(ns >> shift) & ((1 << HIST_SUB_BITS) - 1);
+    return ((shift + 1) << HIST_SUB_BITS) + sub;
+}
+
+// lower bound of a bucket's range
+static uint64_t histValue(int bucket) {
+    if (bucket < (1 << HIST_SUB_BITS)) return (uint64_t)bucket;
+    int shift = (bucket >> HIST_SUB_BITS) - 1;
+    uint64_t sub = (uint64_t)(bucket & ((1 << HIST_SUB_BITS) - 1));
+    return ((uint64_t)(1 << HIST_SUB_BITS) + sub) << shift;
+}
+
+static uint64_t histPercentile(LatencyHist *h, double pct) {
+    double exact = h->total * pct / 100.0;
+    uint64_t rank = (uint64_t)exact;
+    if (rank < exact) rank++;
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->counts[b];
+        if (seen >= rank && h->counts[b]) return histValue(b);
+    }
+    return 0;
+}
+
+static uint64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/********************* TRACE REPLAY *********************/
+typedef struct TraceConfig {
+    const char *name;
+    EvictionPolicy policy;
+    int admission;
+} TraceConfig;
+
+static const TraceConfig traceConfigs[] = {
+    { "lru", POLICY_LRU, 0 },
+    { "clock", POLICY_CLOCK, 0 },
+    { "lru+tinylfu", POLICY_LRU, 1 },
+    { "clock+tinylfu", POLICY_CLOCK, 1 },
+    { "arc", POLICY_ARC, 0 },
+};
+
+// cache-aside replay: get, and put on a miss. the throughput pass runs
+// untimed per op; a second pass on a fresh cache times every operation
+static void replayTrace(const TraceKeys *t, int capacity, const TraceConfig *cfg,
+                        double *opsPerSec, double *hitRatio, LatencyHist *hist) {
+    LRUCache *cache = createPolicyCache(capacity, 0, cfg->policy);
+    if (cfg->admission) enableAdmission(cache);
+
+    long ops = t->ops, hits = 0;
+    double start = nowSeconds();
+    for (long i = 0; i < ops; i++) {
+        const char *key = t->text + t->offsets[i];
+        size_t keyLen = t->offsets[i + 1] - t->offsets[i];
+        if (getValue(cache, key, keyLen, NULL)) hits++;
+        else putValue(cache, key, keyLen, "v", 1);
+    }
+    double elapsed = nowSeconds() - start;
+    freeCache(cache);
+
+    *opsPerSec = elapsed > 0 ? ops / elapsed : 0;
+    *hitRatio = ops ? (double)hits / ops : 0;
+
+    cache = createPolicyCache(capacity, 0, cfg->policy);
+    if (cfg->admission) enableAdmission(cache);
+    memset(hist, 0, sizeof(LatencyHist));
+    for (long i = 0; i < ops; i++) {
+        const char *key = t->text + t->offsets[i];
+        size_t keyLen = t->offsets[i + 1] - t->offsets[i];
+        uint64_t t0 = nowNs();
+        if (!getValue(cache, key, keyLen, NULL)) putValue(cache, key, keyLen, "v", 1);
+        uint64_t t1 = nowNs();
+        hist->counts[histBucket(t1 - t0)]++;
+        hist->total++;
+    }
+    freeCache(cache);
+}
+
+/********************* TRACE BENCHMARK *********************/
+// usage: trace [-t uniform|zipf|scan|loop|all] [-f file] [-n ops] [-k keys]
+//              [-s skew] [-l loopKeys] [-c cap1,cap2,...] [-o out.jsonl]
+// writes one JSON object per (trace, capacity, policy) line to -o (or
+// stdout) and a readable table to stderr
+static int runTraceBenchmark(int argc, char *argv[]) {
+    long ops = TRACE_DEFAULT_OPS, keySpace = TRACE_DEFAULT_KEYS, loopKeys = 0;
+    double skew = TRACE_DEFAULT_SKEW;
+    const char *only = "all", *file = NULL, *outPath = NULL;
+    char capList[256] = "1000,10000,100000";
+
+    for (int i = 2; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-t") == 0) only = argv[i + 1];
+        else if (strcmp(argv[i], "-f") == 0) file = argv[i + 1];
+        else if (strcmp(argv[i], "-n") == 0) ops = atol(argv[i + 1]);
+        else if (strcmp(argv[i], "-k") == 0) keySpace = atol(argv[i + 1]);
+        else if (strcmp(argv[i], "-s") == 0) skew = atof(argv[i + 1]);
+        else if (strcmp(argv[i], "-l") == 0) loopKeys = atol(argv[i + 1]);
+        else if (strcmp(argv[i], "-c") == 0) snprintf(capList, sizeof(capList), "%s", argv[i + 1]);
+        else if (strcmp(argv[i], "-o") == 0) outPath = argv[i + 1];
+    }
+    if (ops < 1) ops = 1;
+    if (keySpace < 2) keySpace = 2;
+    if (loopKeys < 1) loopKeys = keySpace / 10 > 0 ? keySpace / 10 : 1;
+    if (skew == 1.0) skew = 0.9999;   // the sampler needs theta != 1
+
+    FILE *out = outPath ? fopen(outPath, "w") : stdout;
+    if (!out) {
+        perror(outPath);
+        return 1;
+    }
+
+    int capacities[32], capCount = 0;
+    for (char *tok = strtok(capList, ","); tok && capCount < 32; tok = strtok(NULL, ","))
+        if (atoi(tok) > 0) capacities[capCount++] = atoi(tok);
+
+    fprintf(stderr, "%-8s %-9s %-14s %-12s %-8s %-8s %-8s %-8s\n",
+            "trace", "capacity", "policy", "ops/sec", "hit%", "p50ns", "p99ns", "p999ns");
+
+    LatencyHist *hist = (LatencyHist*)malloc(sizeof(LatencyHist));
+    for (int kind = TRACE_UNIFORM; kind <= TRACE_FILE; kind++) {
+        if (file ? kind != TRACE_FILE : (kind == TRACE_FILE ||
+            (strcmp(only, "all") != 0 && strcmp(only, traceNames[kind]) != 0)))
+            continue;
+
+        TraceKeys trace;
+        if (kind != TRACE_FILE)
+            traceFromIds(&trace, generateTrace((TraceKind)kind, ops, keySpace, skew, loopKeys), ops);
+        else if (loadTrace(file, &trace) < 0) {
+            perror(file);
+            break;
+        }
+        long traceOps = trace.ops;
+
+        for (int c = 0; c < capCount; c++) {
+            for (size_t p = 0; p < sizeof(traceConfigs) / sizeof(traceConfigs[0]); p++) {
+                double opsPerSec, hitRatio;
+                replayTrace(&trace, capacities[c], &traceConfigs[p], &opsPerSec, &hitRatio, hist);
+                uint64_t p50 = histPercentile(hist, 50), p99 = histPercentile(hist, 99);
+                uint64_t p999 = histPercentile(hist, 99.9);
+
+                fprintf(out, "{\"trace\":\"%s\",\"ops\":%ld,\"keys\":%ld,\"skew\":%.3f,"
+                        "\"capacity\":%d,\"policy\":\"%s\",\"ops_per_sec\":%.0f,"
+                        "\"hit_ratio\":%.6f,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu}\n",
+                        traceNames[kind], traceOps, kind == TRACE_FILE ? 0 : keySpace,
+                        skew, capacities[c],
+                        traceConfigs[p].name, opsPerSec, hitRatio,
+                        (unsigned long long)p50, (unsigned long long)p99,
+                        (unsigned long long)p999);
+                fprintf(stderr, "%-8s %-9d %-14s %-12.0f %-8.2f %-8llu %-8llu %-8llu\n",
+                        traceNames[kind], capacities[c], traceConfigs[p].name, opsPerSec,
+                        100.0 * hitRatio, (unsigned long long)p50,
+                        (unsigned long long)p99, (unsigned long long)p999);
+            }
+        }
+        free(trace.text);
+        free(trace.offsets);
+    }
+    free(hist);
+
+    if (out != stdout) fclose(out);
+    return 0;
+}
+
+/********************* PARSE POLICY NAME *********************/
+static EvictionPolicy parsePolicy(const char *name) {
+    if (strcmp(name, "arc") == 0) return POLICY_ARC;
+    return strcmp(name, "clock") == 0 ? POLICY_CLOCK : POLICY_LRU;
+}
+
+/********************* READ TOKEN *********************/
+// whitespace-delimited token of any length, grown in *buf; NULL at EOF
+static char* readToken(char **buf, size_t *cap) {
+    int ch;
+    size_t len = 0;
+
+    do { ch = getchar(); } while (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r');
+    if (ch == EOF) return NULL;
+
+    while (ch != EOF && ch != ' ' && ch != '\t' && ch != '\n' && ch != '\r') {
+        if (len + 1 >= *cap) {
+            *cap = *cap ? *cap * 2 : 64;
+            *buf = (char*)realloc(*buf, *cap);
+        }
+        (*buf)[len++] = (char)ch;
+        ch = getchar();
+    }
+    (*buf)[len] = '\0';
+    return *buf;
+}
+
+/********************* BATCH OUTPUT BUFFER *********************/
+// replies for a whole input chunk accumulate here and go out in one write
+typedef struct OutBuf {
+    char *data;
+    size_t len;
+    size_t cap;
+} OutBuf;
+
+static void outAppend(OutBuf *out, const char *bytes, size_t n) {
+    if (out->len + n > out->cap) {
+        while (out->len + n > out->cap) out->cap *= 2;
+        out->data = (char*)realloc(out->data, out->cap);
+    }
+    memcpy(out->data + out->len, bytes, n);
+    out->len += n;
+}
+
+/********************* BATCH TOKENIZER *********************/
+// next space-separated token in [*pos, end); returns 0 when the line is done
+static int nextToken(const char **pos, const char *end, const char **tok, size_t *len) {
+    const char *p = *pos;
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    if (p == end) return 0;
+
+    *tok = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r') p++;
+    *len = (size_t)(p - *tok);
+    *pos = p;
+    return 1;
+}
+
+static int parseInt(const char *tok, size_t len, long long *out) {
+    size_t i = 0;
+    int neg = 0;
+    long long v = 0;
+
+    if (len && (tok[0] == '-' || tok[0] == '+')) neg = (tok[i++] == '-');
+    if (i == len) return 0;
+    for (; i < len; i++) {
+        if (tok[i] < '0' || tok[i] > '9') return 0;
+        v = v * 10 + (tok[i] - '0');
+    }
+    *out = neg ? -v : v;
+    return 1;
+}
+
+/********************* FORMAT STATS *********************/
+// memcached-style "STAT name value" lines closed by END; probe and
+// displacement buckets are only listed when non-empty
+static size_t formatStats(const CacheStats *st, char *buf, size_t cap) {
+    size_t n = 0;
+#define STAT_LINE(...) \
+    do { \
+        int r = snprintf(buf + n, cap - n, __VA_ARGS__); \
+        if (r > 0 && (size_t)r < cap - n) n += (size_t)r; \
+    } while (0)
+
+    uint64_t gets = st->hits + st->tierHits + st->misses;
+    STAT_LINE("STAT hits %llu\n", (unsigned long long)st->hits);
+    STAT_LINE("STAT misses %llu\n", (unsigned long long)st->misses);
+    STAT_LINE("STAT hit_ratio %.4f\n", gets ? (double)(st->hits + st->tierHits) / gets : 0.0);
+    STAT_LINE("STAT inserts %llu\n", (unsigned long long)st->inserts);
+    STAT_LINE("STAT updates %llu\n", (unsigned long long)st->updates);
+    STAT_LINE("STAT evictions %llu\n", (unsigned long long)st->evictions);
+    STAT_LINE("STAT expirations %llu\n", (unsigned long long)st->expirations);
+    STAT_LINE("STAT relinks %llu\n", (unsigned long long)st->relinks);
+    STAT_LINE("STAT entries %llu\n", (unsigned long long)st->entries);
+    STAT_LINE("STAT capacity %llu\n", (unsigned long long)st->capacity);
+    STAT_LINE("STAT bytes %llu\n", (unsigned long long)st->bytes);
+    if (st->spills || st->tierEntries) {
+        STAT_LINE("STAT spills %llu\n", (unsigned long long)st->spills);
+        STAT_LINE("STAT tier_hits %llu\n", (unsigned long long)st->tierHits);
+        STAT_LINE("STAT tier_entries %llu\n", (unsigned long long)st->tierEntries);
+        STAT_LINE("STAT tier_bytes %llu\n", (unsigned long long)st->tierBytes);
+        STAT_LINE("STAT tier_compactions %llu\n", (unsigned long long)st->compactions);
+    }
+    for (int b = 0; b < PROBE_BUCKETS; b++)
+        if (st->probes[b])
+            STAT_LINE("STAT probe_%d%s %llu\n", b + 1, b == PROBE_BUCKETS - 1 ? "+" : "",
+                      (unsigned long long)st->probes[b]);
+    for (int b = 0; b < PROBE_BUCKETS; b++)
+        if (st->displacement[b])
+            STAT_LINE("STAT displacement_%d%s %llu\n", b + 1, b == PROBE_BUCKETS - 1 ? "+" : "",
+                      (unsigned long long)st->displacement[b]);
+    STAT_LINE("END\n");
+#undef STAT_LINE
+    return n;
+}
+
+/********************* BATCH COMMAND *********************/
+// runs one command line; returns 0 on exit
+static int runBatchLine(LRUCache *cache, const char *line, const char *end,
+                        OutBuf *out, long *ops) {
+    const char *cmd, *tok, *val;
+    size_t cmdLen, len, valLen;
+    long long ttl;
+
+    if (!nextToken(&line, end, &cmd, &cmdLen)) return 1;
+
+    if ((cmdLen == 3 && memcmp(cmd, "get", 3) == 0) ||
+        (cmdLen == 4 && memcmp(cmd, "mget", 4) == 0)) {
+        // get k / mget k1 k2 ...: one reply line per key
+        while (nextToken(&line, end, &tok, &len)) {
+            size_t n;
+            char *value = getValue(cache, tok, len, &n);
+            if (value) {
+                outAppend(out, value, n);
+                outAppend(out, "\n", 1);
+            } else {
+                outAppend(out, "NULL\n", 5);
+            }
+            (*ops)++;
+        }
+    }
+    else if ((cmdLen == 3 && memcmp(cmd, "put", 3) == 0) ||
+             (cmdLen == 4 && memcmp(cmd, "mput", 4) == 0)) {
+        // put k v / mput k1 v1 k2 v2 ...: no reply
+        while (nextToken(&line, end, &tok, &len) && nextToken(&line, end, &val, &valLen)) {
+            putValue(cache, tok, len, val, valLen);
+            (*ops)++;
+        }
+    }
+    else if (cmdLen == 6 && memcmp(cmd, "putttl", 6) == 0) {
+        if (nextToken(&line, end, &tok, &len) &&
+            nextToken(&line, end, &val, &valLen) && parseInt(val, valLen, &ttl) &&
+            nextToken(&line, end, &val, &valLen)) {
+            putValueTTL(cache, tok, len, val, valLen, (uint64_t)ttl);
+            (*ops)++;
+        }
+    }
+    else if ((cmdLen == 4 && memcmp(cmd, "save", 4) == 0) ||
+             (cmdLen == 4 && memcmp(cmd, "load", 4) == 0)) {
+        char path[4096], reply[64];
+        if (nextToken(&line, end, &tok, &len) && len < sizeof(path)) {
+            memcpy(path, tok, len);
+            path[len] = '\0';
+            long n = (cmd[0] == 's') ? saveCache(cache, path) : loadCache(cache, path);
+            int r = (n < 0) ? snprintf(reply, sizeof(reply), "ERROR\n")
+                            : snprintf(reply, sizeof(reply), "OK %ld\n", n);
+            outAppend(out, reply, (size_t)r);
+        }
+    }
+    else if (cmdLen == 5 && memcmp(cmd, "stats", 5) == 0) {
+        CacheStats st;
+        char reply[2048];
+        cacheStats(cache, &st);
+        outAppend(out, reply, formatStats(&st, reply, sizeof(reply)));
+    }
+    else if (cmdLen == 4 && memcmp(cmd, "exit", 4) == 0) {
+        return 0;
+    }
+    return 1;
+}
+
+/********************* BATCH DRIVER *********************/
+// pipelined mode for trace replay: reads the input in large chunks, runs
+// every complete line in the chunk and flushes all replies with one write
+static void runBatch(LRUCache *cache, FILE *in) {
+    size_t cap = BATCH_IN_SIZE, have = 0;
+    char *buf = (char*)malloc(cap);
+    OutBuf out = { (char*)malloc(BATCH_OUT_SIZE), 0, BATCH_OUT_SIZE };
+    long ops = 0;
+    int running = 1;
+    double start = nowSeconds();
+
+    while (running) {
+        size_t got = fread(buf + have, 1, cap - have, in);
+        have += got;
+        int eof = (got == 0);
+        if (eof && have == 0) break;
+
+        char *line = buf;
+        char *limit = buf + have;
+        while (running) {
+            char *nl = (char*)memchr(line, '\n', (size_t)(limit - line));
+            // the last line of the file may have no newline
+            if (!nl && !(eof && line < limit)) break;
+            char *lineEnd = nl ? nl : limit;
+            running = runBatchLine(cache, line, lineEnd, &out, &ops);
+            line = nl ? nl + 1 : limit;
+        }
+
+        if (out.len) {
+            fwrite(out.data, 1, out.len, stdout);
+            out.len = 0;
+        }
+
+        // keep the partial trailing line; grow when one line fills the buffer
+        have = (size_t)(limit - line);
+        memmove(buf, line, have);
+        if (have == cap) {
+            cap *= 2;
+            buf = (char*)realloc(buf, cap);
+        }
+        if (eof) break;
+    }
+    fflush(stdout);
+
+    double elapsed = nowSeconds() - start;
+    fprintf(stderr, "%ld ops in %.3f s (%.0f ops/sec)\n", ops, elapsed,
+            elapsed > 0 ? ops / elapsed : 0.0);
+
+    free(buf);
+    free(out.data);
+}
+
+/********************* SOCKET ENDPOINT *********************/
+// a Unix-domain socket path, or a TCP port on 127.0.0.1
+typedef struct Endpoint {
+    const char *unixPath;
+    int port;
+} Endpoint;
+
+static int setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static int openSocket(const Endpoint *ep, int listening) {
+    int fd;
+
+    if (ep->unixPath) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(ep->unixPath) >= sizeof(addr.sun_path)) return -1;
+        strcpy(addr.sun_path, ep->unixPath);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (listening) {
+            unlink(ep->unixPath);   // a stale socket file from an earlier run
+            if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+                listen(fd, SERVER_BACKLOG) == 0)
+                return fd;
+        } else if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+            return fd;
+        }
+    } else {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)ep->port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        int one = 1;
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) return -1;
+        if (listening) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 &&
+                listen(fd, SERVER_BACKLOG) == 0)
+                return fd;
+        } else if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            return fd;
+        }
+    }
+    close(fd);
+    return -1;
+}
+
+/********************* SERVER CONNECTION *********************/
+typedef struct Connection {
+    int fd;
+    char *in;                   // received bytes not yet parsed
+    size_t inLen;
+    size_t inCap;
+    OutBuf out;                 // replies not yet written
+    size_t outSent;
+    int wantWrite;              // EPOLLOUT registered
+    int closing;                // quit seen: close once replies are out
+} Connection;
+
+static Connection* newConnection(int fd) {
+    Connection *c = (Connection*)malloc(sizeof(Connection));
+    c->fd = fd;
+    c->inCap = SERVER_READ_SIZE;
+    c->in = (char*)malloc(c->inCap);
+    c->inLen = 0;
+    c->out.cap = SERVER_READ_SIZE;
+    c->out.data = (char*)malloc(c->out.cap);
+    c->out.len = c->outSent = 0;
+    c->wantWrite = c->closing = 0;
+    return c;
+}
+
+static void closeConnection(int epfd, Connection *c) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c->in);
+    free(c->out.data);
+    free(c);
+}
+
+/********************* SERVER COMMANDS *********************/
+// memcached text protocol subset: get/gets with any number of keys, set,
+// delete, stats, quit. client flags are accepted but not stored, so get
+// always reports 0. set's exptime is seconds, relative unless it is past
+// 30 days, in which case it is a unix time as in memcached
+static void replyValue(OutBuf *out, const char *key, size_t keyLen,
+                       const char *value, size_t len) {
+    char head[32];
+    outAppend(out, "VALUE ", 6);
+    outAppend(out, key, keyLen);
+    outAppend(out, head, (size_t)snprintf(head, sizeof(head), " 0 %zu\r\n", len));
+    outAppend(out, value, len);
+    outAppend(out, "\r\n", 2);
+}
+
+#define REPLY(out, text) outAppend((out), text, sizeof(text) - 1)
+
+// handles every complete command in c->in; returns 0 to drop the client
+static int serverProcess(LRUCache *cache, Connection *c) {
+    size_t pos = 0;
+
+    while (!c->closing) {
+        char *line = c->in + pos;
+        char *nl = (char*)memchr(line, '\n', c->inLen - pos);
+        if (!nl) {
+            // an unterminated line this long is not a command
+            if (c->inLen - pos > SERVER_READ_SIZE) return 0;
+            break;
+        }
+        size_t consumed = (size_t)(nl + 1 - line);
+
+        const char *p = line, *cmd, *tok;
+        size_t cmdLen, len;
+        if (!nextToken(&p, nl, &cmd, &cmdLen)) {
+            pos += consumed;
+            continue;
+        }
+
+        if ((cmdLen == 3 && memcmp(cmd, "get", 3) == 0) ||
+            (cmdLen == 4 && memcmp(cmd, "gets", 4) == 0)) {
+            while (nextToken(&p, nl, &tok, &len)) {
+                size_t n;
+                char *value = len <= SERVER_MAX_KEY ? getValue(cache, tok, len, &n) : NULL;
+                if (value) replyValue(&c->out, tok, len, value, n);
+            }
+            REPLY(&c->out, "END\r\n");
+        }
+        else if (cmdLen == 3 && memcmp(cmd, "set", 3) == 0) {
+            // set <key> <flags> <exptime> <bytes> [noreply]\r\n<data>\r\n
+            const char *key, *f, *e, *b, *nr;
+            size_t keyLen, fLen, eLen, bLen, nrLen;
+            long long flags, exptime, bytes;
+            if (!nextToken(&p, nl, &key, &keyLen) || keyLen > SERVER_MAX_KEY ||
+                !nextToken(&p, nl, &f, &fLen) || !parseInt(f, fLen, &flags) ||
+                !nextToken(&p, nl, &e, &eLen) || !parseInt(e, eLen, &exptime) ||
+                !nextToken(&p, nl, &b, &bLen) || !parseInt(b, bLen, &bytes) || bytes < 0) {
+                REPLY(&c->out, "CLIENT_ERROR bad command line format\r\n");
+                pos += consumed;
+                continue;
+            }
+            int noreply = nextToken(&p, nl, &nr, &nrLen) && nrLen == 7 &&
+                          memcmp(nr, "noreply", 7) == 0;
+            if (bytes > SERVER_MAX_VALUE) {
+                REPLY(&c->out, "SERVER_ERROR object too large for cache\r\n");
+                c->closing = 1;     // the data block cannot be skipped safely
+                break;
+            }
+            if (c->inLen - pos - consumed < (size_t)bytes + 2) break;   // wait for the data
+
+            const char *data = nl + 1;
+            consumed += (size_t)bytes + 2;
+            if (data[bytes] != '\r' || data[bytes + 1] != '\n') {
+                REPLY(&c->out, "CLIENT_ERROR bad data chunk\r\n");
+                pos += consumed;
+                continue;
+            }
+
+            int stored;
+            if (exptime < 0) {
+                deleteValue(cache, key, keyLen);    // already expired
+                stored = 1;
+            } else {
+                uint64_t ttlMs = 0;
+                if (exptime > 2592000) {
+                    long long left = exptime - (long long)time(NULL);
+                    ttlMs = left > 0 ? (uint64_t)left * 1000 : 1;
+                } else if (exptime > 0) {
+                    ttlMs = (uint64_t)exptime * 1000;
+                }
+                stored = putValueTTL(cache, key, keyLen, data, (size_t)bytes, ttlMs);
+            }
+            if (!noreply) {
+                if (stored) REPLY(&c->out, "STORED\r\n");
+                else REPLY(&c->out, "SERVER_ERROR out of memory storing object\r\n");
+            }
+        }
+        else if (cmdLen == 6 && memcmp(cmd, "delete", 6) == 0) {
+            // delete <key> [noreply]
+            const char *nr;
+            size_t nrLen;
+            if (!nextToken(&p, nl, &tok, &len) || len > SERVER_MAX_KEY) {
+                REPLY(&c->out, "CLIENT_ERROR bad command line format\r\n");
+            } else {
+                int noreply = nextToken(&p, nl, &nr, &nrLen) && nrLen == 7 &&
+                              memcmp(nr, "noreply", 7) == 0;
+                int found = deleteValue(cache, tok, len);
+                if (!noreply) {
+                    if (found) REPLY(&c->out, "DELETED\r\n");
+                    else REPLY(&c->out, "NOT_FOUND\r\n");
+                }
+            }
+        }
+        else if (cmdLen == 5 && memcmp(cmd, "stats", 5) == 0) {
+            CacheStats st;
+            char reply[2048];
+            cacheStats(cache, &st);
+            size_t n = formatStats(&st, reply, sizeof(reply));
+            // the protocol wants CRLF line ends
+            for (size_t i = 0, start = 0; i < n; i++) {
+                if (reply[i] != '\n') continue;
+                outAppend(&c->out, reply + start, i - start);
+                REPLY(&c->out, "\r\n");
+                start = i + 1;
+            }
+        }
+        else if (cmdLen == 4 && memcmp(cmd, "quit", 4) == 0) {
+            c->closing = 1;
+        }
+        else {
+            REPLY(&c->out, "ERROR\r\n");
+        }
+        pos += consumed;
+    }
+
+    c->inLen -= pos;
+    memmove(c->in, c->in + pos, c->inLen);
+    return 1;
+}
+
+/********************* SERVER WRITE *********************/
+// writes what the socket takes and watches for EPOLLOUT only while a
+// backlog remains; returns 0 if the client is gone
+static int serverFlush(int epfd, Connection *c) {
+    while (c->outSent < c->out.len) {
+        ssize_t n = write(c->fd, c->out.data + c->outSent, c->out.len - c->outSent);
+        if (n > 0) {
+            c->outSent += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        return 0;
+    }
+
+    int backlog = c->outSent < c->out.len;
+    if (!backlog) c->out.len = c->outSent = 0;
+
+    if (backlog != c->wantWrite) {
+        // a client this far behind is not read from until it catches up
+        struct epoll_event ev;
+        ev.events = backlog ? (c->out.len - c->outSent > SERVER_OUT_HIGH ? EPOLLOUT : EPOLLIN | EPOLLOUT)
+                            : EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->wantWrite = backlog;
+    }
+    return backlog || !c->closing;
+}
+
+/********************* SERVER LOOP *********************/
+static volatile sig_atomic_t serverStop = 0;
+
+static void onServerSignal(int sig) {
+    (void)sig;
+    serverStop = 1;
+}
+
+// single-threaded epoll loop around one LRUCache: level-triggered, non-
+// blocking sockets, and every command already received is answered before
+// the replies are written, so pipelined requests share one write. the wait
+// doubles as the expiry tick while entries have TTLs. runs until SIGINT or
+// SIGTERM; returns 0 on a clean shutdown
+static int runServer(const Endpoint *ep, LRUCache *cache) {
+    int lfd = openSocket(ep, 1);
+    if (lfd < 0 || setNonBlocking(lfd) < 0) {
+        perror(ep->unixPath ? ep->unixPath : "listen");
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onServerSignal;     // no SA_RESTART: epoll_wait returns EINTR
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    int epfd = epoll_create1(0);
+    struct epoll_event ev, events[SERVER_MAX_EVENTS];
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;                 // NULL marks the listening socket
+    epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev);
+
+    if (ep->unixPath) fprintf(stderr, "listening on %s\n", ep->unixPath);
+    else fprintf(stderr, "listening on 127.0.0.1:%d\n", ep->port);
+
+    while (!serverStop) {
+        int timeout = cache->wheel.count ? REAPER_INTERVAL_MS : -1;
+        int n = epoll_wait(epfd, events, SERVER_MAX_EVENTS, timeout);
+        if (n < 0 && errno != EINTR) break;
+        if (cache->wheel.count) expireEntries(cache);
+
+        for (int i = 0; i < n; i++) {
+            Connection *c = (Connection*)events[i].data.ptr;
+
+            if (!c) {
+                int fd;
+                while ((fd = accept(lfd, NULL, NULL)) >= 0) {
+                    int one = 1;
+                    setNonBlocking(fd);
+                    if (!ep->unixPath) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    Connection *conn = newConnection(fd);
+                    ev.events = EPOLLIN;
+                    ev.data.ptr = conn;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+                }
+                continue;
+            }
+
+            int alive = 1;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                if (c->inCap - c->inLen < SERVER_READ_SIZE) {
+                    c->inCap *= 2;
+                    c->in = (char*)realloc(c->in, c->inCap);
+                }
+                ssize_t got = read(c->fd, c->in + c->inLen, c->inCap - c->inLen);
+                if (got > 0) {
+                    c->inLen += (size_t)got;
+                    alive = serverProcess(cache, c);
+                } else if (got == 0 || (errno != EAGAIN && errno != EINTR)) {
+                    alive = 0;
+                }
+            }
+            if (alive) alive = serverFlush(epfd, c);
+            if (!alive) closeConnection(epfd, c);
+        }
+    }
+
+    // connections still open are dropped with the process
+    close(epfd);
+    close(lfd);
+    if (ep->unixPath) unlink(ep->unixPath);
+    return 0;
+}
+
+/********************* LOAD GENERATOR *********************/
+// drives a server with `conns` connections, each keeping `depth` requests
+// pipelined. keys are BENCH_KEY_LEN bytes over `keys` ids, uniform or
+// zipfian; gets may ask for several keys at once. every response is
+// timed from the moment its request was written
+typedef struct LoadConn {
+    int fd;
+    char *in;
+    size_t inLen;
+    size_t inCap;
+    OutBuf out;
+    size_t outSent;
+    uint64_t sentAt[LOADGEN_MAX_DEPTH];     // ring of in-flight request times
+    uint8_t isGet[LOADGEN_MAX_DEPTH];
+    int head;
+    int inFlight;
+} LoadConn;
+
+typedef struct LoadConfig {
+    int conns;
+    int depth;
+    long ops;
+    long keys;
+    double skew;                // 0 for uniform keys
+    int getPercent;
+    int keysPerGet;
+    int valueSize;
+} LoadConfig;
+
+static void loadFlush(int epfd, LoadConn *lc) {
+    while (lc->outSent < lc->out.len) {
+        ssize_t n = write(lc->fd, lc->out.data + lc->outSent, lc->out.len - lc->outSent);
+        if (n > 0) lc->outSent += (size_t)n;
+        else break;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | (lc->outSent < lc->out.len ? EPOLLOUT : 0);
+    ev.data.ptr = lc;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, lc->fd, &ev);
+    if (lc->outSent == lc->out.len) lc->out.len = lc->outSent = 0;
+}
+
+// parses complete responses; returns how many finished, adding key hits
+static int loadParse(LoadConn *lc, LatencyHist *hist, long *hits) {
+    size_t pos = 0;
+    int done = 0;
+    uint64_t now = nowNs();
+
+    while (lc->inFlight > 0) {
+        char *line = lc->in + pos;
+        char *nl = (char*)memchr(line, '\n', lc->inLen - pos);
+        if (!nl) break;
+        size_t consumed = (size_t)(nl + 1 - line);
+
+        if (lc->isGet[lc->head] && strncmp(line, "VALUE ", 6) == 0) {
+            // VALUE <key> <flags> <bytes>: the data block must be here too
+            char *sp = nl;
+            while (sp > line && sp[-1] != ' ') sp--;
+            size_t bytes = (size_t)strtoul(sp, NULL, 10);
+            if (lc->inLen - pos - consumed < bytes + 2) break;
+            pos += consumed + bytes + 2;
+            (*hits)++;
+            continue;
+        }
+
+        // END for a get, a single status line for a set
+        pos += consumed;
+        hist->counts[histBucket(now - lc->sentAt[lc->head])]++;
+        hist->total++;
+        lc->head = (lc->head + 1) % LOADGEN_MAX_DEPTH;
+        lc->inFlight--;
+        done++;
+    }
+
+    lc->inLen -= pos;
+    memmove(lc->in, lc->in + pos, lc->inLen);
+    return done;
+}
+
+static int runLoadGen(const Endpoint *ep, const LoadConfig *cfg) {
+    LoadConn *lcs = (LoadConn*)calloc((size_t)cfg->conns, sizeof(LoadConn));
+    int epfd = epoll_create1(0);
+
+    for (int i = 0; i < cfg->conns; i++) {
+        LoadConn *lc = &lcs[i];
+        // the server may still be starting up
+        struct timespec retry = { 0, 10 * 1000000L };
+        for (int tries = 0; (lc->fd = openSocket(ep, 0)) < 0 && tries < 200; tries++)
+            nanosleep(&retry, NULL);
+        if (lc->fd < 0) {
+            perror("connect");
+            return 1;
+        }
+        setNonBlocking(lc->fd);
+        lc->inCap = SERVER_READ_SIZE;
+        lc->in = (char*)malloc(lc->inCap);
+        lc->out.cap = SERVER_READ_SIZE;
+        lc->out.data = (char*)malloc(lc->out.cap);
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = lc;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, lc->fd, &ev);
+    }
+
+    ZipfGen zipf;
+    if (cfg->skew > 0) zipfInit(&zipf, cfg->keys, cfg->skew);
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    char *value = (char*)malloc((size_t)cfg->valueSize + 2);
+    memset(value, 'x', (size_t)cfg->valueSize);
+    memcpy(value + cfg->valueSize, "\r\n", 2);
+    char setHead[64];
+    int setHeadLen = snprintf(setHead, sizeof(setHead), " 0 0 %d\r\n", cfg->valueSize);
+
+    LatencyHist *hist = (LatencyHist*)calloc(1, sizeof(LatencyHist));
+    long issued = 0, completed = 0, hits = 0, lookups = 0;
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    double start = nowSeconds();
+
+    while (completed < cfg->ops) {
+        // top every connection's pipeline up, then wait for replies
+        for (int i = 0; i < cfg->conns; i++) {
+            LoadConn *lc = &lcs[i];
+            int added = 0;
+            while (lc->inFlight < cfg->depth && issued < cfg->ops) {
+                int slot = (lc->head + lc->inFlight) % LOADGEN_MAX_DEPTH;
+                char key[BENCH_KEY_LEN];
+                int isGet = (int)(xorshift64(&seed) % 100) < cfg->getPercent;
+
+                if (isGet) {
+                    outAppend(&lc->out, "get", 3);
+                    for (int k = 0; k < cfg->keysPerGet; k++) {
+                        long id = cfg->skew > 0 ? zipfNext(&zipf, &seed)
+                                                : (long)(xorshift64(&seed) % (uint64_t)cfg->keys);
+                        benchKey(key, id);
+                        outAppend(&lc->out, " ", 1);
+                        outAppend(&lc->out, key, BENCH_KEY_LEN);
+                    }
+                    outAppend(&lc->out, "\r\n", 2);
+                    lookups += cfg->keysPerGet;
+                } else {
+                    long id = cfg->skew > 0 ? zipfNext(&zipf, &seed)
+                                            : (long)(xorshift64(&seed) % (uint64_t)cfg->keys);
+                    benchKey(key, id);
+                    outAppend(&lc->out, "set ", 4);
+                    outAppend(&lc->out, key, BENCH_KEY_LEN);
+                    outAppend(&lc->out, setHead, (size_t)setHeadLen);
+                    outAppend(&lc->out, value, (size_t)cfg->valueSize + 2);
+                }
+                lc->isGet[slot] = (uint8_t)isGet;
+                lc->sentAt[slot] = nowNs();
+                lc->inFlight++;
+                issued++;
+                added = 1;
+            }
+            if (added) loadFlush(epfd, lc);
+        }
+
+        int n = epoll_wait(epfd, events, SERVER_MAX_EVENTS, 1000);
+        if (n == 0) {
+            fprintf(stderr, "no reply from server for 1 s\n");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            LoadConn *lc = (LoadConn*)events[i].data.ptr;
+            if (events[i].events & EPOLLOUT) loadFlush(epfd, lc);
+            if (!(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) continue;
+
+            if (lc->inCap - lc->inLen < SERVER_READ_SIZE) {
+                lc->inCap *= 2;
+                lc->in = (char*)realloc(lc->in, lc->inCap);
+            }
+            ssize_t got = read(lc->fd, lc->in + lc->inLen, lc->inCap - lc->inLen);
+            if (got <= 0) {
+                if (got < 0 && errno == EAGAIN) continue;
+                fprintf(stderr, "server closed the connection\n");
+                completed = cfg->ops;
+                break;
+            }
+            lc->inLen += (size_t)got;
+            completed += loadParse(lc, hist, &hits);
+        }
+    }
+    double elapsed = nowSeconds() - start;
+
+    printf("conns=%d depth=%d ops=%ld keys=%ld skew=%.2f get%%=%d keys/get=%d value=%d\n",
+           cfg->conns, cfg->depth, cfg->ops, cfg->keys, cfg->skew, cfg->getPercent,
+           cfg->keysPerGet, cfg->valueSize);
+    printf("%-12s %-8s %-8s %-8s %-8s\n", "ops/sec", "hit%", "p50ns", "p99ns", "p999ns");
+    printf("%-12.0f %-8.2f %-8llu %-8llu %-8llu\n", elapsed > 0 ? completed / elapsed : 0.0,
+           lookups ? 100.0 * hits / lookups : 0.0,
+           (unsigned long long)histPercentile(hist, 50),
+           (unsigned long long)histPercentile(hist, 99),
+           (unsigned long long)histPercentile(hist, 99.9));
+
+    for (int i = 0; i < cfg->conns; i++) {
+        close(lcs[i].fd);
+        free(lcs[i].in);
+        free(lcs[i].out.data);
+    }
+    free(lcs);
+    free(value);
+    free(hist);
+    close(epfd);
+    return 0;
+}
+
+/********************* WARM RESTART *********************/
+static void restoreSnapshot(LRUCache *cache, const char *path) {
+    double start = nowSeconds();
+    long n = loadCache(cache, path);
+    if (n >= 0)
+        fprintf(stderr, "restored %ld entries from %s in %.1f ms\n",
+                n, path, (nowSeconds() - start) * 1000);
+}
+
+static void persistSnapshot(LRUCache *cache, const char *path) {
+    if (saveCache(cache, path) < 0) perror(path);
+}
+
+/********************* SELF CHECK *********************/
+// regression checks that need no fixtures; prints each failure and
+// returns the number of them
+static int runSelfCheck(void) {
+    int failures = 0;
+    char path[64], key[16];
+    snprintf(path, sizeof(path), "/tmp/lru-check-%d.snap", (int)getpid());
+
+    // a snapshot restored under W-TinyLFU fills the window as well as the
+    // main region, so the next put has a window entry to drain
+    for (int p = 0; p < 2; p++) {
+        EvictionPolicy policy = p ? POLICY_CLOCK : POLICY_LRU;
+        LRUCache *cache = createPolicyCache(10, 0, policy);
+        for (int i = 0; i < 10; i++) {
+            snprintf(key, sizeof(key), "k%d", i);
+            put(cache, key, "v");
+        }
+        long saved = saveCache(cache, path);
+        freeCache(cache);
+
+        cache = createPolicyCache(10, 0, policy);
+        enableAdmission(cache);
+        long loaded = loadCache(cache, path);
+        int window = cache->winSize;
+        put(cache, "fresh", "v");
+        if (saved != 10 || loaded != 10 || window != cache->winCapacity ||
+            cache->size > cache->capacity || !get(cache, "fresh")) {
+            printf("FAIL: snapshot load with admission (%s)\n", p ? "clock" : "lru");
+            failures++;
+        }
+        freeCache(cache);
+    }
+    unlink(path);
+
+    printf("%s\n", failures ? "self check failed" : "self check passed");
+    return failures;
+}
+
+/********************* MAIN DRIVER *********************/
+// build: gcc -O2 -pthread LRUCacheImplementation.c -lm
+int main(int argc, char *argv[]) {
+    // usage: LRUCacheImplementation bench [capacity] [shards] [lru|clock|arc] [keys]
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        int capacity = (argc > 2) ? atoi(argv[2]) : 100000;
+        int shards = (argc > 3) ? atoi(argv[3]) : DEFAULT_SHARDS;
+        EvictionPolicy policy = (argc > 4) ? parsePolicy(argv[4]) : POLICY_LRU;
+        if (capacity < 1) capacity = 1;
+        int keySpace = (argc > 5) ? atoi(argv[5]) : capacity * 2;
+        if (keySpace < 1) keySpace = 1;
+        runBenchmark(capacity, shards, policy, keySpace);
+        return 0;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "trace") == 0)
+        return runTraceBenchmark(argc, argv);
+
+    // usage: LRUCacheImplementation loadgen [-u path | -t port] [-c conns] [-d depth]
+    //            [-n ops] [-k keys] [-z skew] [-g get%] [-b keys/get] [-v bytes] [-S capacity]
+    // -S forks a server with that capacity on the endpoint for the run
+    if (argc > 1 && strcmp(argv[1], "loadgen") == 0) {
+        Endpoint ep = { NULL, 11311 };
+        LoadConfig cfg = { 4, 16, 1000000, 100000, 0.0, 90, 1, 32 };
+        int spawn = 0;
+        for (int i = 2; i + 1 < argc; i += 2) {
+            if (strcmp(argv[i], "-u") == 0) ep.unixPath = argv[i + 1];
+            else if (strcmp(argv[i], "-t") == 0) ep.port = atoi(argv[i + 1]);
+            else if (strcmp(argv[i], "-c") == 0) cfg.conns = atoi(argv[i + 1]);
+            else if (strcmp(argv[i], "-d") == 0) cfg.depth = atoi(argv[i + 1]);
+            else if (strcmp(argv[i], "-n") == 0) cfg.ops = atol(argv[i + 1]);
+            else if (strcmp(argv[i], "-k") == 0) cfg.keys = atol(argv[i + 1]);
+            else if (strcmp(argv[i], "-z") == 0) cfg.skew = atof(argv[i + 1]);
+            else if (strcmp(argv[i], "-g") == 0) cfg.getPercent = atoi(argv[i + 1]);
+            else if (strcmp(argv[i], "-b") == 0) cfg.keysPerGet = atoi(argv[i + 1]);
+            else if (strcmp(argv[i], "-v") == 0) cfg.valueSize = atoi(argv[i + 1]);
+            else if (strcmp(argv[i], "-S") == 0) spawn = atoi(argv[i + 1]);
+        }
+        if (cfg.conns < 1) cfg.conns = 1;
+        if (cfg.depth < 1) cfg.depth = 1;
+        if (cfg.depth > LOADGEN_MAX_DEPTH) cfg.depth = LOADGEN_MAX_DEPTH;
+        if (cfg.keys < 2) cfg.keys = 2;
+        if (cfg.keysPerGet < 1) cfg.keysPerGet = 1;
+        if (cfg.valueSize < 0) cfg.valueSize = 0;
+        if (cfg.skew == 1.0) cfg.skew = 0.9999;   // the sampler needs theta != 1
+
+        pid_t server = -1;
+        if (spawn > 0) {
+            server = fork();
+            if (server == 0) {
+                LRUCache *cache = createCache(spawn);
+                int rc = runServer(&ep, cache);
+                freeCache(cache);
+                _exit(rc);
+            }
+        }
+        int rc = runLoadGen(&ep, &cfg);
+        if (server > 0) {
+            kill(server, SIGTERM);
+            waitpid(server, NULL, 0);
+        }
+        return rc;
+    }
+
+    // usage: LRUCacheImplementation check
+    if (argc > 1 && strcmp(argv[1], "check") == 0)
+        return runSelfCheck() ? 1 : 0;
+
+    // usage: LRUCacheImplementation keys [entries]
+    if (argc > 1 && strcmp(argv[1], "keys") == 0) {
+        int entries = (argc > 2) ? atoi(argv[2]) : 1000000;
+        if (entries < 1) entries = 1;
+        runKeyBenchmark(entries);
+        return 0;
+    }
+
+    // usage: LRUCacheImplementation scan [capacity]
+    if (argc > 1 && strcmp(argv[1], "scan") == 0) {
+        int capacity = (argc > 2) ? atoi(argv[2]) : 10000;
+        if (capacity < 2) capacity = 2;
+        runScanBenchmark(capacity);
+        return 0;
+    }
+
+    // usage: LRUCacheImplementation [-m maxBytes] [-p lru|clock|arc] [-a] [-r snapshot]
+    //                               [-T tierPrefix] [-D tierBytes]
+    //        LRUCacheImplementation batch <capacity> [trace] [flags...]
+    //        LRUCacheImplementation serve <capacity> [-u path | -t port] [flags...]
+    // -r restores the cache from the snapshot at start and saves it at exit,
+    // -T spills evictions to a disk tier of up to -D bytes (default 1 GB)
+    size_t maxBytes = 0;
+    const char *snapshot = NULL;
+    const char *tierPrefix = NULL;
+    uint64_t tierBytes = 0;
+    EvictionPolicy policy = POLICY_LRU;
+    int admission = 0;
+    Endpoint ep = { NULL, 11311 };
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) maxBytes = (size_t)strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) policy = parsePolicy(argv[++i]);
+        else if (strcmp(argv[i], "-a") == 0) admission = 1;
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) snapshot = argv[++i];
+        else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) ep.unixPath = argv[++i];
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) ep.port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc) tierPrefix = argv[++i];
+        else if (strcmp(argv[i], "-D") == 0 && i + 1 < argc) tierBytes = strtoull(argv[++i], NULL, 10);
+    }
+
+    if (argc > 2 && strcmp(argv[1], "serve") == 0) {
+        LRUCache *cache = createPolicyCache(atoi(argv[2]), maxBytes, policy);
+        if (admission) enableAdmission(cache);
+        if (tierPrefix && enableDiskTier(cache, tierPrefix, tierBytes) < 0) {
+            perror(tierPrefix);
+            return 1;
+        }
+        if (snapshot) restoreSnapshot(cache, snapshot);
+        int rc = runServer(&ep, cache);
+        if (snapshot) persistSnapshot(cache, snapshot);
+        freeCache(cache);
+        return rc;
+    }
+
+    if (argc > 2 && strcmp(argv[1], "batch") == 0) {
+        FILE *in = stdin;
+        if (argc > 3 && argv[3][0] != '-') {
+            in = fopen(argv[3], "rb");
+            if (!in) {
+                perror(argv[3]);
+                return 1;
+            }
+        }
+
+        LRUCache *cache = createPolicyCache(atoi(argv[2]), maxBytes, policy);
+        if (admission) enableAdmission(cache);
+        if (tierPrefix && enableDiskTier(cache, tierPrefix, tierBytes) < 0) {
+            perror(tierPrefix);
+            return 1;
+        }
+        if (snapshot) restoreSnapshot(cache, snapshot);
+        runBatch(cache, in);
+        if (snapshot) persistSnapshot(cache, snapshot);
+        freeCache(cache);
+        if (in != stdin) fclose(in);
+        return 0;
+    }
+
+    int size;
+    printf("Enter cache capacity: ");
+    scanf("%d", &size);
+
+    LRUCache *cache = createPolicyCache(size, maxBytes, policy);
+    if (admission) enableAdmission(cache);
+    if (tierPrefix && enableDiskTier(cache, tierPrefix, tierBytes) < 0) {
+        perror(tierPrefix);
+        return 1;
+    }
+    if (snapshot) restoreSnapshot(cache, snapshot);
+
+    char command[50];
+    char *key = NULL, *data = NULL;
+    size_t keyCap = 0, dataCap = 0;
+
+    while (1) {
+        if (scanf("%49s", command) != 1) {
+            if (snapshot) persistSnapshot(cache, snapshot);
+            freeCache(cache);
+            break;
+        }
+
+        if (strcmp(command, "put") == 0) {
+            if (readToken(&key, &keyCap) && readToken(&data, &dataCap)) put(cache, key, data);
+        }
+        else if (strcmp(command, "putttl") == 0) {
+            // putttl <key> <ttl ms> <value>
+            unsigned long long ttl;
+            if (readToken(&key, &keyCap) && scanf("%llu", &ttl) == 1 &&
+                readToken(&data, &dataCap))
+                putTTL(cache, key, data, (uint64_t)ttl);
+        }
+        else if (strcmp(command, "get") == 0) {
+            if (!readToken(&key, &keyCap)) continue;
+            char *result = get(cache, key);
+            if (result) printf("%s\n", result);
+            else printf("NULL\n");
+        }
+        else if (strcmp(command, "save") == 0 || strcmp(command, "load") == 0) {
+            // save <file> / load <file>
+            if (!readToken(&data, &dataCap)) continue;
+            long n = (command[0] == 's') ? saveCache(cache, data) : loadCache(cache, data);
+            if (n < 0) printf("ERROR\n");
+            else printf("OK %ld\n", n);
+        }
+        else if (strcmp(command, "stats") == 0) {
+            CacheStats st;
+            char reply[2048];
+            cacheStats(cache, &st);
+            formatStats(&st, reply, sizeof(reply));
+            fputs(reply, stdout);
         }
         else if (strcmp(command, "exit") == 0) {
+            if (snapshot) persistSnapshot(cache, snapshot);
             freeCache(cache);
             break;
         }
     }
 
+    free(key);
+    free(data);
     return 0;
 }
@@ -2,17 +2,47 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#define BLOCK_SIZE 512
-#define TOTAL_BLOCKS 1024
+#define DEFAULT_BLOCK_SIZE 512
+#define DEFAULT_TOTAL_BLOCKS 1024
+#define MIN_BLOCK_SIZE 512
+#define MAX_BLOCK_SIZE 65536
+#define MAX_TOTAL_BLOCKS (1 << 30)
 #define NAME_LIMIT 50    /* max name length (excluding NUL) */
 #define LINE_BUF 8192
+#define DIR_HASH_THRESHOLD 32   /* directories index their names past this many entries */
+#define PATH_LIMIT 4096         /* longest absolute path, including NUL */
+#define DCACHE_SIZE 4096        /* path lookup cache slots (power of two) */
+#define IMAGE_MAGIC "VFSIMG1"
+#define IMAGE_VERSION 5
+#define IMAGE_ALIGN 4096        /* image regions start on page boundaries */
+#define BYTES_PER_INODE 1024    /* inode table sizing at format; untouched slots cost nothing */
+#define MIN_INODES 65536
+#define MAX_INODES (1u << 28)
+#define ANON_INODES (1u << 22)  /* floor for an in-memory image */
+#define INLINE_EXTENTS 5        /* extents stored in the inode itself */
+#define ROOT_INO 0
+#define NO_INO UINT32_MAX
+#define INODE_USED 1
+#define INODE_DIR 2
+#define INODE_EXTENTS 4         /* overflow record holding more extents of a file */
+#define JOURNAL_MAGIC "VFSJRNL"
+#define RECORD_MAGIC "VFSJREC"
+#define JOURNAL_PAGE IMAGE_ALIGN    /* unit of metadata logging */
+#define DEFAULT_GROUP_COMMIT 64     /* commands per journal commit */
+#define FEATURE_DEDUP 1             /* blocks are shared by content */
 
-/* Free block (doubly linked list) */
-typedef struct FreeBlock {
-    int index;
-    struct FreeBlock *prev, *next;
-} FreeBlock;
+/* Contiguous run of file blocks */
+typedef struct Extent {
+    int start;
+    int length;
+} Extent;
 
 /* File / Directory node (circular doubly linked siblings) */
 typedef struct FileNode {
@@ -22,20 +52,169 @@ typedef struct FileNode {
     struct FileNode *next;    /* sibling next */
     struct FileNode *prev;    /* sibling prev */
     struct FileNode *parent;
-    int *blockPointers;       /* dynamic array for file blocks (NULL for dirs) */
-    int blockCount;
-    int blockCap;
+    uint32_t nameHash;
+    struct FileNode *hashNext;    /* chain in the parent's name index */
+    struct FileNode **hashTable;  /* name index, built once a directory grows large */
+    uint32_t hashMask;
+    int childCount;
+    char *path;                   /* cached absolute path (dirs only), see dirPath */
+    unsigned pathGen;
+    Extent *extents;          /* file layout in block order (NULL for dirs) */
+    int extentCount;
+    int extentCap;
+    int blockCount;           /* total blocks over all extents */
+    int records;              /* extent overflow records chained to the inode */
+    uint64_t size;            /* file length in bytes */
+    uint32_t ino;             /* slot in the image's inode table */
+    bool loaded;              /* children (dirs) or extents (files) read from the image */
+    int dirtyIndex;           /* position in fs.dirty, -1 when in sync with the image */
 } FileNode;
 
+/* On-image inode, 128 bytes. directories chain their children in creation
+   order through nextSibling; files keep their first extents inline and the
+   rest in a chain of INODE_EXTENTS records linked through overflow */
+typedef struct DiskInode {
+    char name[NAME_LIMIT + 1];
+    uint8_t flags;
+    uint32_t parent;
+    uint32_t nextSibling;
+    uint32_t firstChild;
+    uint32_t lastChild;
+    uint32_t extentCount;     /* all extents of the file, inline and overflow */
+    uint32_t overflow;
+    Extent extents[INLINE_EXTENTS];
+    uint64_t size;            /* file length in bytes */
+} DiskInode;
+
+/* On-image superblock, at offset 0 */
+typedef struct SuperBlock {
+    char magic[8];
+    uint32_t version;
+    uint32_t blockSize;
+    uint32_t totalBlocks;
+    uint32_t inodeCount;
+    uint32_t freeCount;
+    uint32_t freeInodes;
+    uint32_t features;        /* FEATURE_* chosen at format */
+    uint64_t logicalBlocks;   /* dedup: file blocks, counting each sharer */
+    uint64_t bitmapOffset;    /* free block bitmap, then its summary */
+    uint64_t summaryOffset;
+    uint64_t inodeMapOffset;  /* free inode bitmap */
+    uint64_t inodeOffset;
+    uint64_t blockInfoOffset; /* dedup: BlockInfo per data block */
+    uint64_t journalOffset;   /* everything before this is logged metadata */
+    uint64_t journalPages;
+    uint64_t dataOffset;
+    uint64_t imageSize;
+} SuperBlock;
+
+/* Dedup bookkeeping for one data block */
+typedef struct BlockInfo {
+    uint64_t fingerprint;     /* hash of the full block, 0 if not indexed */
+    uint32_t refs;            /* file blocks pointing here */
+    uint32_t reserved;
+} BlockInfo;
+
+/* Fingerprint index slot; block -1 = empty */
+typedef struct DedupSlot {
+    uint64_t fingerprint;
+    int block;
+} DedupSlot;
+
+/* First journal page. records start on the next page, and only the run
+   of valid records numbered from startSeq up is replayed */
+typedef struct JournalHeader {
+    char magic[8];
+    uint64_t startSeq;
+} JournalHeader;
+
+/* One committed transaction: this header page, then the page numbers,
+   then the full images of those metadata pages */
+typedef struct JournalRecord {
+    char magic[8];
+    uint64_t seq;
+    uint32_t pageCount;
+    uint32_t listPages;
+    uint64_t checksum;        /* over the page numbers and images */
+} JournalRecord;
+
+typedef struct JournalStats {
+    uint64_t commits;
+    uint64_t fsyncs;
+    uint64_t ops;             /* commands covered by those commits */
+    uint64_t pages;           /* metadata pages logged */
+    uint64_t bytes;           /* bytes written to the journal */
+    uint64_t checkpoints;     /* journal wrapped back to its start */
+    uint64_t replayed;        /* records applied at mount */
+    double commitSeconds;
+} JournalStats;
+
+/* Path lookup cache slot: absolute path -> node */
+typedef struct DentryCache {
+    uint32_t hash;
+    FileNode *node;               /* NULL when empty */
+} DentryCache;
+
+/* outcome of growing or writing a file */
+enum { WRITE_OK, WRITE_NO_SPACE, WRITE_NO_INODES };
+
 /* File system container */
 typedef struct FileSystem {
-    unsigned char disk[TOTAL_BLOCKS][BLOCK_SIZE];
-    FreeBlock *freeHead;
-    FreeBlock *freeTail;  /* tail for reinsertion at tail */
+    int blockSize;                /* geometry, fixed when the image is formatted */
+    int totalBlocks;
+    int bitmapWords;
+    int summaryWords;
+    unsigned char *data;          /* data blocks, inside the image mapping */
+    uint64_t *usedMap;            /* bit set = block in use (or past the end) */
+    uint64_t *fullSummary;        /* bit set = usedMap word has no free block */
     int freeCount;
 
+    int imageFd;                  /* -1 for an anonymous (in-memory) image */
+    unsigned char *image;         /* metadata (or, anonymous, the whole image) */
+    size_t imageSize;             /* bytes mapped at image */
+    unsigned char *dataMap;       /* separate shared mapping of the data blocks */
+    size_t dataSize;
+    SuperBlock *sb;
+    DiskInode *inodes;
+    uint64_t *inodeMap;           /* bit set = inode in use */
+    uint32_t inodeHint;           /* inode map word to start the next search at */
+    FileNode **dirty;             /* nodes whose inode needs rewriting */
+    int dirtyCount;
+    int dirtyCap;
+
+    /* metadata journal, image files only. the metadata mapping is private,
+       so changes reach the file only through a commit */
+    bool journaling;
+    uint32_t metaPages;           /* pages before the journal */
+    uint64_t *txPageMap;          /* bit per metadata page changed since the last commit */
+    uint32_t *txPages;
+    uint32_t txPageCount;
+    Extent *pendingFree;          /* blocks freed since the last commit */
+    int pendingCount;
+    int pendingCap;
+    int pendingBlocks;            /* free, but not allocatable until the commit */
+    bool commitSoon;              /* an allocation waited on pendingFree */
+    uint64_t journalSeq;          /* sequence number of the next record */
+    uint64_t journalHead;         /* next free journal page */
+    unsigned char *journalBuf;
+    size_t journalBufSize;
+    int groupCommit;              /* commands per commit */
+    int batchOps;                 /* commands since the last commit */
+    JournalStats jstats;
+
+    /* block deduplication, images formatted with -d only */
+    bool dedup;
+    BlockInfo *blockInfo;
+    uint64_t logicalBlocks;
+    DedupSlot *dedupIndex;        /* fingerprint -> block, built on first use */
+    uint32_t dedupMask;
+    uint32_t dedupCount;
+    unsigned char *dedupBuf;      /* one block being assembled */
+
     FileNode *root;
     FileNode *cwd;
+    unsigned pathGen;             /* bumped when a directory rename changes cached paths */
+    DentryCache dcache[DCACHE_SIZE];
 } FileSystem;
 
 static FileSystem fs;
@@ -59,62 +238,287 @@ static bool valid_name(const char *name) {
     return true;
 }
 
-/* ---------- Free block list ---------- */
+/* ---------- Metadata change tracking ---------- */
+
+/* note that bytes [p, p + len) of the metadata mapping changed, so their
+   pages go into the next journal commit */
+static void metaTouch(const void *p, size_t len) {
+    if (!fs.journaling) return;
+    size_t off = (size_t)((const unsigned char *)p - fs.image);
+    uint32_t first = (uint32_t)(off / JOURNAL_PAGE);
+    uint32_t last = (uint32_t)((off + len - 1) / JOURNAL_PAGE);
+    for (uint32_t pg = first; pg <= last; ++pg) {
+        uint64_t bit = 1ULL << (pg % 64);
+        if (fs.txPageMap[pg / 64] & bit) continue;
+        fs.txPageMap[pg / 64] |= bit;
+        fs.txPages[fs.txPageCount++] = pg;
+    }
+}
+
+/* ---------- Free space bitmap ---------- */
+
+/* the bitmaps count used space, so a freshly formatted image is all zero
+   pages and costs nothing until blocks are allocated */
 
-static void addFreeBlockTail(int idx) {
-    FreeBlock *b = malloc(sizeof(FreeBlock));
-    if (!b) die("malloc failed");
-    b->index = idx;
-    b->next = NULL;
-    b->prev = fs.freeTail;
-    if (!fs.freeHead) fs.freeHead = b;
-    else fs.freeTail->next = b;
-    fs.freeTail = b;
-    fs.freeCount++;
+static unsigned char *blockData(int b) {
+    return fs.data + (size_t)b * (size_t)fs.blockSize;
 }
 
-static int allocBlock() {
-    if (!fs.freeHead) return -1;
-    FreeBlock *h = fs.freeHead;
-    int idx = h->index;
-    fs.freeHead = h->next;
-    if (fs.freeHead) fs.freeHead->prev = NULL;
-    else fs.freeTail = NULL;
-    free(h);
-    fs.freeCount--;
-    return idx;
+/* bits [lo, hi) of a 64-bit word, hi - lo in 1..64 */
+static uint64_t bitRange(int lo, int hi) {
+    uint64_t m = (hi - lo == 64) ? ~0ULL : ((1ULL << (hi - lo)) - 1);
+    return m << lo;
 }
 
-static void freeBlock(int idx) {
-    addFreeBlockTail(idx);
+/* set the bits of blocks [start, start + count) in the used map and keep
+   the summary in step */
+static void setUsedBits(int start, int count, bool used) {
+    int end = start + count;
+    while (start < end) {
+        int w = start / 64, lo = start % 64;
+        int hi = (end - w * 64 < 64) ? end - w * 64 : 64;
+        uint64_t m = bitRange(lo, hi);
+        if (used) fs.usedMap[w] |= m;
+        else fs.usedMap[w] &= ~m;
+        if (fs.usedMap[w] == ~0ULL) fs.fullSummary[w / 64] |= 1ULL << (w % 64);
+        else fs.fullSummary[w / 64] &= ~(1ULL << (w % 64));
+        metaTouch(&fs.usedMap[w], sizeof(uint64_t));
+        metaTouch(&fs.fullSummary[w / 64], sizeof(uint64_t));
+        start = w * 64 + hi;
+    }
+}
+
+/* mark blocks [start, start + count) free or used. with a journal, freed
+   blocks stay allocated in the bitmap until the commit that frees them,
+   so a crash can never find a committed file whose blocks were reused */
+static void markBlocks(int start, int count, bool isFree) {
+    fs.freeCount += isFree ? count : -count;
+    if (!isFree || !fs.journaling) { setUsedBits(start, count, !isFree); return; }
+
+    if (fs.pendingCount == fs.pendingCap) {
+        int cap = fs.pendingCap ? fs.pendingCap * 2 : 64;
+        Extent *tmp = realloc(fs.pendingFree, sizeof(Extent) * cap);
+        if (!tmp) die("realloc failed");
+        fs.pendingFree = tmp;
+        fs.pendingCap = cap;
+    }
+    fs.pendingFree[fs.pendingCount].start = start;
+    fs.pendingFree[fs.pendingCount].length = count;
+    fs.pendingCount++;
+    fs.pendingBlocks += count;
 }
 
+static void applyPendingFrees(void) {
+    for (int i = 0; i < fs.pendingCount; ++i)
+        setUsedBits(fs.pendingFree[i].start, fs.pendingFree[i].length, false);
+    fs.pendingCount = 0;
+    fs.pendingBlocks = 0;
+}
+
+/* first free block at or after `from`, or -1 */
+static int nextFreeBlock(int from) {
+    if (from >= fs.totalBlocks) return -1;
+    int w = from / 64;
+    uint64_t bits = ~fs.usedMap[w] & (~0ULL << (from % 64));
+    if (bits) return w * 64 + __builtin_ctzll(bits);
+
+    /* skip whole words with the summary: one bit per bitmap word */
+    for (int sw = (w + 1) / 64; sw < fs.summaryWords; ++sw) {
+        uint64_t sum = ~fs.fullSummary[sw];
+        if (sw == (w + 1) / 64) sum &= ~0ULL << ((w + 1) % 64);
+        if (sum) {
+            int fw = sw * 64 + __builtin_ctzll(sum);
+            return fw * 64 + __builtin_ctzll(~fs.usedMap[fw]);
+        }
+    }
+    return -1;
+}
+
+/* first used block in [from, limit), or limit: end of a free run */
+static int nextUsedBlock(int from, int limit) {
+    while (from < limit) {
+        int w = from / 64;
+        uint64_t used = fs.usedMap[w] & (~0ULL << (from % 64));
+        if (used) {
+            int b = w * 64 + __builtin_ctzll(used);
+            return b < limit ? b : limit;
+        }
+        from = (w + 1) * 64;
+    }
+    return limit;
+}
+
+/* allocate up to `want` contiguous blocks in one call: the first free run
+   long enough, else the longest run there is. returns the first block and
+   the run length through *got, or -1 when the disk is full */
+static int allocRun(int want, int *got) {
+    int bestStart = -1, bestLen = 0;
+    for (int b = nextFreeBlock(0); b >= 0; ) {
+        /* look no further than `want` blocks: on a large empty disk the
+           run after b can be millions of blocks long */
+        int limit = (fs.totalBlocks - b > want) ? b + want : fs.totalBlocks;
+        int end = nextUsedBlock(b, limit);
+        if (end - b >= want) { bestStart = b; bestLen = want; break; }
+        if (end - b > bestLen) { bestStart = b; bestLen = end - b; }
+        b = nextFreeBlock(end);
+    }
+    if (bestStart < 0) {
+        /* blocks freed since the last commit come back only once that
+           commit is durable; have the current command end with it */
+        if (fs.pendingCount > 0) fs.commitSoon = true;
+        return -1;
+    }
+    markBlocks(bestStart, bestLen, false);
+    *got = bestLen;
+    return bestStart;
+}
+
+/* claim up to `want` free blocks starting exactly at `start`; returns how
+   many were taken, 0 when `start` is in use */
+static int claimRunAt(int start, int want) {
+    if (start >= fs.totalBlocks || nextFreeBlock(start) != start) return 0;
+    int limit = (fs.totalBlocks - start > want) ? start + want : fs.totalBlocks;
+    int got = nextUsedBlock(start, limit) - start;
+    markBlocks(start, got, false);
+    return got;
+}
+
+
 /* ---------- FileNode helpers ---------- */
 
+/* FNV-1a */
+static uint32_t hashName(const char *name) {
+    uint32_t h = 2166136261u;
+    for (; *name; ++name) {
+        h ^= (unsigned char)*name;
+        h *= 16777619u;
+    }
+    return h;
+}
+
 static void initFileNode(FileNode *n, const char *name, bool isDir) {
     safe_strcpy(n->name, name);
     n->isDir = isDir;
     n->child = NULL;
     n->next = n->prev = n; /* self circular default */
     n->parent = NULL;
-    n->blockPointers = NULL;
+    n->nameHash = hashName(n->name);
+    n->hashNext = NULL;
+    n->hashTable = NULL;
+    n->hashMask = 0;
+    n->childCount = 0;
+    n->path = NULL;
+    n->pathGen = 0;
+    n->size = 0;
+    n->ino = NO_INO;
+    n->loaded = true;
+    n->dirtyIndex = -1;
+    n->extents = NULL;
+    n->extentCount = 0;
+    n->extentCap = 0;
     n->blockCount = 0;
-    n->blockCap = 0;
+    n->records = 0;
 }
 
-static void ensureBlockCapacity(FileNode *f, int need) {
-    if (f->blockCap >= need) return;
-    int cap = (f->blockCap == 0) ? 4 : f->blockCap;
-    while (cap < need) cap *= 2;
-    int *tmp = realloc(f->blockPointers, sizeof(int) * cap);
-    if (!tmp) die("realloc failed");
-    f->blockPointers = tmp;
-    f->blockCap = cap;
+/* add blocks [start, start + length) at the end of the file, merging with
+   the last extent when the run continues it */
+static void appendExtent(FileNode *f, int start, int length) {
+    if (f->extentCount > 0) {
+        Extent *last = &f->extents[f->extentCount - 1];
+        if (last->start + last->length == start) {
+            last->length += length;
+            f->blockCount += length;
+            return;
+        }
+    }
+    if (f->extentCount == f->extentCap) {
+        int cap = (f->extentCap == 0) ? 2 : f->extentCap * 2;
+        Extent *tmp = realloc(f->extents, sizeof(Extent) * cap);
+        if (!tmp) die("realloc failed");
+        f->extents = tmp;
+        f->extentCap = cap;
+    }
+    f->extents[f->extentCount].start = start;
+    f->extents[f->extentCount].length = length;
+    f->extentCount++;
+    f->blockCount += length;
+}
+
+/* shrink the file to its first `blocks` blocks, one bitmap update per
+   released run */
+static void dropBlocks(int start, int count);
+
+static void truncateExtents(FileNode *f, int blocks) {
+    int kept = 0, e = 0;
+    for (; e < f->extentCount && kept < blocks; ++e) {
+        Extent *x = &f->extents[e];
+        if (kept + x->length > blocks) {
+            int keep = blocks - kept;
+            dropBlocks(x->start + keep, x->length - keep);
+            x->length = keep;
+        }
+        kept += x->length;
+    }
+    for (int i = e; i < f->extentCount; ++i)
+        dropBlocks(f->extents[i].start, f->extents[i].length);
+    f->extentCount = e;
+    f->blockCount = kept;
+}
+
+/* queue a node's inode for the next syncMetadata */
+static void markDirty(FileNode *n) {
+    if (n->dirtyIndex >= 0) return;
+    if (fs.dirtyCount == fs.dirtyCap) {
+        int cap = fs.dirtyCap ? fs.dirtyCap * 2 : 64;
+        FileNode **tmp = realloc(fs.dirty, sizeof(FileNode *) * cap);
+        if (!tmp) die("realloc failed");
+        fs.dirty = tmp;
+        fs.dirtyCap = cap;
+    }
+    n->dirtyIndex = fs.dirtyCount;
+    fs.dirty[fs.dirtyCount++] = n;
+}
+
+/* ---------- Directory name index ---------- */
+
+static void hashLink(FileNode *dir, FileNode *node) {
+    FileNode **slot = &dir->hashTable[node->nameHash & dir->hashMask];
+    node->hashNext = *slot;
+    *slot = node;
 }
 
+static void hashUnlink(FileNode *dir, FileNode *node) {
+    FileNode **slot = &dir->hashTable[node->nameHash & dir->hashMask];
+    while (*slot != node) slot = &(*slot)->hashNext;
+    *slot = node->hashNext;
+    node->hashNext = NULL;
+}
+
+/* (re)build the index with one bucket per entry, rounded to a power of two */
+static void hashRebuild(FileNode *dir, uint32_t buckets) {
+    free(dir->hashTable);
+    dir->hashTable = calloc(buckets, sizeof(FileNode *));
+    if (!dir->hashTable) die("malloc failed");
+    dir->hashMask = buckets - 1;
+    FileNode *t = dir->child;
+    do {
+        hashLink(dir, t);
+        t = t->next;
+    } while (t != dir->child);
+}
+
+static void loadNode(FileNode *n);
+
 /* find child by name (in cwd or given parent) */
 static FileNode *findChild(FileNode *parent, const char *name) {
+    loadNode(parent);
     if (!parent->child) return NULL;
+    if (parent->hashTable) {
+        uint32_t h = hashName(name);
+        for (FileNode *t = parent->hashTable[h & parent->hashMask]; t; t = t->hashNext)
+            if (t->nameHash == h && strcmp(t->name, name) == 0) return t;
+        return NULL;
+    }
     FileNode *t = parent->child;
     do {
         if (strcmp(t->name, name) == 0) return t;
@@ -124,7 +528,7 @@ static FileNode *findChild(FileNode *parent, const char *name) {
 }
 
 /* insert child at tail (maintain circular list) */
-static void insertChild(FileNode *parent, FileNode *node) {
+static void linkChild(FileNode *parent, FileNode *node) {
     node->parent = parent;
     if (!parent->child) {
         parent->child = node;
@@ -137,12 +541,37 @@ static void insertChild(FileNode *parent, FileNode *node) {
         node->next = head;
         head->prev = node;
     }
+
+    /* the sibling list keeps creation order for ls; the index only
+       answers lookups, and doubles when it averages one entry per bucket */
+    parent->childCount++;
+    if (parent->hashTable) {
+        if ((uint32_t)parent->childCount > parent->hashMask + 1)
+            hashRebuild(parent, (parent->hashMask + 1) * 2);
+        else
+            hashLink(parent, node);
+    } else if (parent->childCount > DIR_HASH_THRESHOLD) {
+        hashRebuild(parent, DIR_HASH_THRESHOLD * 2);
+    }
+}
+
+/* link a new or moved node, queueing every inode whose links change */
+static void insertChild(FileNode *parent, FileNode *node) {
+    loadNode(parent);
+    linkChild(parent, node);
+    markDirty(node);
+    markDirty(node->prev);    /* the old tail, whose nextSibling is now node */
+    markDirty(parent);
 }
 
 /* unlink node from parent's child circular list (no freeing) */
 static void unlinkNode(FileNode *node) {
     FileNode *parent = node->parent;
     if (!parent) return;
+    if (node->prev != node) markDirty(node->prev);
+    markDirty(parent);
+    if (parent->hashTable) hashUnlink(parent, node);
+    parent->childCount--;
     if (node->next == node) {
         parent->child = NULL;
     } else {
@@ -154,6 +583,19 @@ static void unlinkNode(FileNode *node) {
     node->parent = NULL;
 }
 
+/* release a node's memory; the image is not touched */
+static void destroyNode(FileNode *node) {
+    if (node->dirtyIndex >= 0) {
+        FileNode *last = fs.dirty[--fs.dirtyCount];
+        fs.dirty[node->dirtyIndex] = last;
+        last->dirtyIndex = node->dirtyIndex;
+    }
+    free(node->extents);
+    free(node->hashTable);
+    free(node->path);
+    free(node);
+}
+
 /* recursively free entire subtree (node and its descendants) */
 static void freeDirectoryTree(FileNode *node) {
     if (!node) return;
@@ -166,120 +608,1232 @@ static void freeDirectoryTree(FileNode *node) {
             t = next;
         } while (t != child);
     }
-    if (!node->isDir) {
-        for (int i = 0; i < node->blockCount; ++i)
-            freeBlock(node->blockPointers[i]);
-        free(node->blockPointers);
+    destroyNode(node);
+}
+
+/* ---------- Disk image ---------- */
+
+/* inode bit set/cleared, same layout as the block bitmap */
+static uint32_t allocInode(void) {
+    uint32_t words = fs.sb->inodeCount / 64;
+    for (uint32_t i = 0; i < words; ++i) {
+        uint32_t w = (fs.inodeHint + i) % words;
+        if (~fs.inodeMap[w]) {
+            uint32_t ino = w * 64 + (uint32_t)__builtin_ctzll(~fs.inodeMap[w]);
+            fs.inodeMap[w] |= fs.inodeMap[w] + 1;
+            fs.inodeHint = w;
+            fs.sb->freeInodes--;
+            metaTouch(&fs.inodeMap[w], sizeof(uint64_t));
+            metaTouch(fs.sb, sizeof(SuperBlock));
+            metaTouch(&fs.inodes[ino], sizeof(DiskInode));
+            memset(&fs.inodes[ino], 0, sizeof(DiskInode));
+            fs.inodes[ino].flags = INODE_USED;
+            fs.inodes[ino].parent = fs.inodes[ino].nextSibling = NO_INO;
+            fs.inodes[ino].firstChild = fs.inodes[ino].lastChild = NO_INO;
+            fs.inodes[ino].overflow = NO_INO;
+            return ino;
+        }
     }
-    free(node);
+    return NO_INO;
 }
 
-/* ---------- Commands (preserve exact wording) ---------- */
+static void freeInode(uint32_t ino) {
+    fs.inodes[ino].flags = 0;
+    fs.inodeMap[ino / 64] &= ~(1ULL << (ino % 64));
+    fs.sb->freeInodes++;
+    metaTouch(&fs.inodes[ino], sizeof(DiskInode));
+    metaTouch(&fs.inodeMap[ino / 64], sizeof(uint64_t));
+    metaTouch(fs.sb, sizeof(SuperBlock));
+}
 
-static void mkdirCmd(const char *name) {
-    if (!valid_name(name)) { printf("Invalid name.\n"); return; }
-    if (findChild(fs.cwd, name)) { printf("Entry with name '%s' already exists.\n", name); return; }
+/* release a file's extent overflow chain starting at *link */
+static void freeOverflow(uint32_t *link) {
+    uint32_t ino = *link;
+    if (ino == NO_INO) return;
+    *link = NO_INO;
+    metaTouch(link, sizeof(*link));
+    while (ino != NO_INO) {
+        uint32_t next = fs.inodes[ino].overflow;
+        freeInode(ino);
+        ino = next;
+    }
+}
+
+/* build a node for inode `ino`; its children or extents load on first use */
+static FileNode *nodeFromInode(uint32_t ino) {
+    const DiskInode *di = &fs.inodes[ino];
     FileNode *n = malloc(sizeof(FileNode));
     if (!n) die("malloc failed");
-    initFileNode(n, name, true);
-    insertChild(fs.cwd, n);
-    printf("Directory '%s' created successfully.\n", name);
+    initFileNode(n, di->name, (di->flags & INODE_DIR) != 0);
+    n->ino = ino;
+    n->loaded = false;
+    return n;
 }
 
-static void createCmd(const char *name) {
-    if (!valid_name(name)) { printf("Invalid name.\n"); return; }
-    if (findChild(fs.cwd, name)) { printf("Entry with name '%s' already exists.\n", name); return; }
+/* read a directory's children or a file's extents from the image, touching
+   only the inodes involved */
+static void loadNode(FileNode *n) {
+    if (n->loaded) return;
+    n->loaded = true;
+    const DiskInode *di = &fs.inodes[n->ino];
+    if (n->isDir) {
+        for (uint32_t c = di->firstChild; c != NO_INO; c = fs.inodes[c].nextSibling)
+            linkChild(n, nodeFromInode(c));
+        return;
+    }
+    n->size = di->size;
+    for (uint32_t o = di->overflow; o != NO_INO; o = fs.inodes[o].overflow) n->records++;
+    uint32_t left = di->extentCount;
+    for (const DiskInode *r = di; left > 0; r = &fs.inodes[r->overflow]) {
+        for (int i = 0; i < INLINE_EXTENTS && left > 0; ++i, --left)
+            appendExtent(n, r->extents[i].start, r->extents[i].length);
+    }
+}
+
+/* make sure a file's overflow chain can hold `extents` extents, taking the
+   records before the blocks they describe are claimed, so that storing
+   the inode never needs a free one. storeInode gives back what goes
+   unused. false when the inode table is full */
+static bool reserveRecords(FileNode *f, int extents) {
+    int want = extents > INLINE_EXTENTS ? (extents - 1) / INLINE_EXTENTS : 0;
+    if (want <= f->records) return true;
+    uint32_t *link = &fs.inodes[f->ino].overflow;
+    while (*link != NO_INO) link = &fs.inodes[*link].overflow;
+    for (; f->records < want; f->records++) {
+        uint32_t ino = allocInode();
+        if (ino == NO_INO) return false;
+        fs.inodes[ino].flags = INODE_USED | INODE_EXTENTS;
+        *link = ino;
+        metaTouch(link, sizeof(*link));
+        link = &fs.inodes[ino].overflow;
+    }
+    return true;
+}
+
+/* serialise a node into its inode; an unloaded node only changes its own
+   name and links */
+static void storeInode(FileNode *n) {
+    DiskInode *di = &fs.inodes[n->ino];
+    metaTouch(di, sizeof(*di));
+    safe_strcpy(di->name, n->name);
+    di->flags = INODE_USED | (n->isDir ? INODE_DIR : 0);
+    di->parent = n->parent ? n->parent->ino : NO_INO;
+    di->nextSibling = (n->parent && n->next != n->parent->child) ? n->next->ino : NO_INO;
+    if (!n->loaded) return;
+
+    if (n->isDir) {
+        di->firstChild = n->child ? n->child->ino : NO_INO;
+        di->lastChild = n->child ? n->child->prev->ino : NO_INO;
+        return;
+    }
+    di->size = n->size;
+    di->extentCount = (uint32_t)n->extentCount;
+    uint32_t *link = NULL;
+    DiskInode *r = di;
+    int used = 0;
+    for (int e = 0; e < n->extentCount; ) {
+        if (link) {
+            r = &fs.inodes[*link];    /* reserved along with the extents */
+            metaTouch(r, sizeof(*r));
+            used++;
+        }
+        for (int i = 0; i < INLINE_EXTENTS && e < n->extentCount; ++i, ++e)
+            r->extents[i] = n->extents[e];
+        link = &r->overflow;
+    }
+    freeOverflow(link ? link : &di->overflow);
+    n->records = used;
+}
+
+/* write every queued node back to its inode, in the mapping; a journal
+   commit then carries the changed pages to the image file */
+static void syncMetadata(void) {
+    for (int i = 0; i < fs.dirtyCount; ++i) {
+        storeInode(fs.dirty[i]);
+        fs.dirty[i]->dirtyIndex = -1;
+    }
+    fs.dirtyCount = 0;
+    if (fs.sb->freeCount != (uint32_t)fs.freeCount || fs.sb->logicalBlocks != fs.logicalBlocks) {
+        fs.sb->freeCount = (uint32_t)fs.freeCount;
+        fs.sb->logicalBlocks = fs.logicalBlocks;
+        metaTouch(fs.sb, sizeof(SuperBlock));
+    }
+}
+
+/* give a node's blocks and inode back; it must already be unlinked */
+static void releaseNode(FileNode *n) {
+    if (!n->isDir) {
+        loadNode(n);
+        truncateExtents(n, 0);
+        freeOverflow(&fs.inodes[n->ino].overflow);
+    }
+    freeInode(n->ino);
+    destroyNode(n);
+}
+
+/* ---------- Metadata journal ---------- */
+
+/* Write-ahead, page-granular redo log for the metadata regions (superblock,
+   bitmaps, inode table). a commit appends one record holding every page
+   changed since the previous commit and fsyncs once, so a batch of
+   commands costs a single flush; only then are the pages written to their
+   home locations. mount replays committed records over the home pages.
+   data blocks are not logged: they are written in place, and the same
+   fsync makes the blocks of every committed file durable */
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* FNV-1a, 64-bit */
+static uint64_t checksum64(const void *p, size_t n) {
+    const unsigned char *b = p;
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= b[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static void writeAll(int fd, const void *buf, size_t n, uint64_t off) {
+    const unsigned char *p = buf;
+    while (n > 0) {
+        ssize_t w = pwrite(fd, p, n, (off_t)off);
+        if (w <= 0) die("disk image write failed");
+        p += w;
+        n -= (size_t)w;
+        off += (uint64_t)w;
+    }
+}
+
+static bool readAll(int fd, void *buf, size_t n, uint64_t off) {
+    unsigned char *p = buf;
+    while (n > 0) {
+        ssize_t r = pread(fd, p, n, (off_t)off);
+        if (r <= 0) return false;
+        p += r;
+        n -= (size_t)r;
+        off += (uint64_t)r;
+    }
+    return true;
+}
+
+static void imageSync(void) {
+    if (fsync(fs.imageFd) < 0) die("disk image sync failed");
+    fs.jstats.fsyncs++;
+}
+
+static void writeJournalHeader(uint64_t journalOffset, uint64_t startSeq) {
+    JournalHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+    h.startSeq = startSeq;
+    writeAll(fs.imageFd, &h, sizeof(h), journalOffset);
+}
+
+static int comparePages(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* write `count` sorted metadata pages from `images` (page i at
+   images + i * JOURNAL_PAGE) to their home locations, one pwrite per run */
+static void writeHomePages(const uint32_t *pages, uint32_t count, const unsigned char *images) {
+    for (uint32_t i = 0; i < count; ) {
+        uint32_t j = i + 1;
+        while (j < count && pages[j] == pages[j - 1] + 1) ++j;
+        writeAll(fs.imageFd, images + (size_t)i * JOURNAL_PAGE,
+                 (size_t)(j - i) * JOURNAL_PAGE, (uint64_t)pages[i] * JOURNAL_PAGE);
+        i = j;
+    }
+}
+
+/* make every home write durable, then start the journal over; the new
+   header is flushed too before any record can land behind it */
+static void journalCheckpoint(void) {
+    imageSync();
+    writeJournalHeader(fs.sb->journalOffset, fs.journalSeq);
+    imageSync();
+    fs.journalHead = 1;
+    fs.jstats.checkpoints++;
+}
+
+/* log the open transaction as one record, fsync, then write its pages
+   home. the home writes need no flush of their own: until the next
+   checkpoint the journal can always redo them */
+static void journalCommit(void) {
+    if (!fs.journaling) return;
+    applyPendingFrees();
+    fs.commitSoon = false;
+    uint64_t ops = (uint64_t)fs.batchOps;
+    fs.batchOps = 0;
+    if (fs.txPageCount == 0) return;
+
+    double t0 = nowSeconds();
+    uint32_t n = fs.txPageCount;
+    qsort(fs.txPages, n, sizeof(uint32_t), comparePages);
+    uint32_t listPages = (uint32_t)((n * sizeof(uint32_t) + JOURNAL_PAGE - 1) / JOURNAL_PAGE);
+    uint64_t recPages = 1 + (uint64_t)listPages + n;
+    if (fs.journalHead + recPages > fs.sb->journalPages) journalCheckpoint();
+
+    size_t bytes = (size_t)recPages * JOURNAL_PAGE;
+    if (fs.journalBufSize < bytes) {
+        unsigned char *tmp = realloc(fs.journalBuf, bytes);
+        if (!tmp) die("realloc failed");
+        fs.journalBuf = tmp;
+        fs.journalBufSize = bytes;
+    }
+    unsigned char *list = fs.journalBuf + JOURNAL_PAGE;
+    unsigned char *images = list + (size_t)listPages * JOURNAL_PAGE;
+    memset(fs.journalBuf, 0, (size_t)(1 + listPages) * JOURNAL_PAGE);
+    memcpy(list, fs.txPages, n * sizeof(uint32_t));
+    for (uint32_t i = 0; i < n; ++i)
+        memcpy(images + (size_t)i * JOURNAL_PAGE, fs.image + (size_t)fs.txPages[i] * JOURNAL_PAGE, JOURNAL_PAGE);
+
+    JournalRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    memcpy(rec.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC));
+    rec.seq = fs.journalSeq;
+    rec.pageCount = n;
+    rec.listPages = listPages;
+    rec.checksum = checksum64(list, bytes - JOURNAL_PAGE);
+    memcpy(fs.journalBuf, &rec, sizeof(rec));
+
+    writeAll(fs.imageFd, fs.journalBuf, bytes, fs.sb->journalOffset + fs.journalHead * JOURNAL_PAGE);
+    imageSync();
+    writeHomePages(fs.txPages, n, images);
+
+    for (uint32_t i = 0; i < n; ++i) fs.txPageMap[fs.txPages[i] / 64] = 0;
+    fs.txPageCount = 0;
+    fs.journalHead += recPages;
+    fs.journalSeq++;
+
+    fs.jstats.commits++;
+    fs.jstats.ops += ops;
+    fs.jstats.pages += n;
+    fs.jstats.bytes += bytes;
+    fs.jstats.commitSeconds += nowSeconds() - t0;
+}
+
+/* called after every command: group commit once enough have run, or
+   at once when the disk ran short while blocks were waiting to be freed */
+static void endCommand(void) {
+    syncMetadata();
+    if (fs.journaling && (++fs.batchOps >= fs.groupCommit || fs.commitSoon)) journalCommit();
+}
+
+/* redo the committed records of an image's journal before it is mapped,
+   and leave the journal empty. returns the next sequence number */
+static uint64_t journalReplay(const SuperBlock *sb) {
+    JournalHeader h;
+    if (!readAll(fs.imageFd, &h, sizeof(h), sb->journalOffset) ||
+        memcmp(h.magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) != 0)
+        die("corrupt disk image journal");
+
+    uint32_t metaPages = (uint32_t)(sb->journalOffset / JOURNAL_PAGE);
+    uint64_t seq = h.startSeq, page = 1;
+    unsigned char *buf = NULL;
+    for (;;) {
+        JournalRecord rec;
+        uint64_t at = sb->journalOffset + page * JOURNAL_PAGE;
+        if (page >= sb->journalPages || !readAll(fs.imageFd, &rec, sizeof(rec), at)) break;
+        if (memcmp(rec.magic, RECORD_MAGIC, sizeof(RECORD_MAGIC)) != 0 || rec.seq != seq ||
+            rec.pageCount == 0 || rec.pageCount > metaPages ||
+            rec.listPages != (rec.pageCount * sizeof(uint32_t) + JOURNAL_PAGE - 1) / JOURNAL_PAGE)
+            break;
+        uint64_t recPages = 1 + (uint64_t)rec.listPages + rec.pageCount;
+        if (page + recPages > sb->journalPages) break;
+
+        size_t bytes = (size_t)(recPages - 1) * JOURNAL_PAGE;
+        unsigned char *tmp = realloc(buf, bytes);
+        if (!tmp) die("realloc failed");
+        buf = tmp;
+        if (!readAll(fs.imageFd, buf, bytes, at + JOURNAL_PAGE) ||
+            checksum64(buf, bytes) != rec.checksum)
+            break;    /* torn record: the commit never completed */
+
+        const uint32_t *pages = (const uint32_t *)buf;
+        bool sane = true;
+        for (uint32_t i = 0; i < rec.pageCount; ++i)
+            if (pages[i] >= metaPages || (i > 0 && pages[i] <= pages[i - 1])) sane = false;
+        if (!sane) break;
+        writeHomePages(pages, rec.pageCount, buf + (size_t)rec.listPages * JOURNAL_PAGE);
+
+        fs.jstats.replayed++;
+        page += recPages;
+        seq++;
+    }
+    free(buf);
+
+    if (seq != h.startSeq) {
+        imageSync();
+        writeJournalHeader(sb->journalOffset, seq);
+        imageSync();
+    }
+    return seq;
+}
+
+/* start logging changes to the freshly mapped metadata */
+static void journalStart(uint64_t seq) {
+    fs.journaling = true;
+    fs.metaPages = (uint32_t)(fs.sb->journalOffset / JOURNAL_PAGE);
+    fs.txPageMap = calloc((fs.metaPages + 63) / 64, sizeof(uint64_t));
+    fs.txPages = malloc(sizeof(uint32_t) * fs.metaPages);
+    if (!fs.txPageMap || !fs.txPages) die("malloc failed");
+    fs.txPageCount = 0;
+    fs.journalSeq = seq;
+    fs.journalHead = 1;
+}
+
+static void journalStop(void) {
+    free(fs.txPageMap);
+    free(fs.txPages);
+    free(fs.pendingFree);
+    free(fs.journalBuf);
+    fs.txPageMap = NULL;
+    fs.txPages = NULL;
+    fs.pendingFree = NULL;
+    fs.journalBuf = NULL;
+    fs.pendingCount = fs.pendingCap = 0;
+    fs.pendingBlocks = 0;
+    fs.commitSoon = false;
+    fs.journalBufSize = 0;
+    fs.journaling = false;
+}
+
+static size_t alignUp(size_t v) {
+    return (v + IMAGE_ALIGN - 1) / IMAGE_ALIGN * IMAGE_ALIGN;
+}
+
+/* inode table slots for a new image: one per BYTES_PER_INODE of disk, so
+   files (and the overflow records of fragmented ones) run out with the
+   space rather than at a fixed count */
+static uint32_t inodesFor(int blockSize, int totalBlocks, bool anonymous) {
+    uint64_t n = (uint64_t)blockSize * (uint64_t)totalBlocks / BYTES_PER_INODE;
+    if (anonymous && n < ANON_INODES) n = ANON_INODES;
+    if (n < MIN_INODES) n = MIN_INODES;
+    if (n > MAX_INODES) n = MAX_INODES;
+    return (uint32_t)((n + 63) / 64 * 64);
+}
+
+/* superblock, block bitmap + summary, inode bitmap, inode table, block
+   info (dedup only), journal, data. the journal can hold a record of every
+   metadata page at once, so any transaction fits after a checkpoint */
+static void layoutImage(SuperBlock *sb, int blockSize, int totalBlocks, uint32_t inodeCount,
+                        uint32_t features) {
+    uint64_t bitmapWords = ((uint64_t)totalBlocks + 63) / 64;
+    uint64_t summaryWords = (bitmapWords + 63) / 64;
+    memset(sb, 0, sizeof(*sb));
+    memcpy(sb->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    sb->version = IMAGE_VERSION;
+    sb->blockSize = (uint32_t)blockSize;
+    sb->totalBlocks = (uint32_t)totalBlocks;
+    sb->inodeCount = inodeCount;
+    sb->features = features;
+    sb->bitmapOffset = IMAGE_ALIGN;
+    sb->summaryOffset = sb->bitmapOffset + bitmapWords * sizeof(uint64_t);
+    sb->inodeMapOffset = alignUp(sb->summaryOffset + summaryWords * sizeof(uint64_t));
+    sb->inodeOffset = alignUp(sb->inodeMapOffset + inodeCount / 64 * sizeof(uint64_t));
+    sb->blockInfoOffset = alignUp(sb->inodeOffset + (uint64_t)inodeCount * sizeof(DiskInode));
+    uint64_t infoBytes = (features & FEATURE_DEDUP) ? (uint64_t)totalBlocks * sizeof(BlockInfo) : 0;
+    sb->journalOffset = alignUp(sb->blockInfoOffset + infoBytes);
+    uint64_t metaPages = sb->journalOffset / JOURNAL_PAGE;
+    sb->journalPages = 2 + (metaPages * sizeof(uint32_t) + JOURNAL_PAGE - 1) / JOURNAL_PAGE + metaPages;
+    sb->dataOffset = sb->journalOffset + sb->journalPages * JOURNAL_PAGE;
+    sb->imageSize = sb->dataOffset + (uint64_t)totalBlocks * blockSize;
+}
+
+static bool validGeometry(uint64_t blockSize, uint64_t totalBlocks) {
+    return blockSize >= MIN_BLOCK_SIZE && blockSize <= MAX_BLOCK_SIZE &&
+           (blockSize & (blockSize - 1)) == 0 &&
+           totalBlocks >= 1 && totalBlocks <= MAX_TOTAL_BLOCKS;
+}
+
+static void mapRegions(unsigned char *data) {
+    fs.sb = (SuperBlock *)fs.image;
+    fs.blockSize = (int)fs.sb->blockSize;
+    fs.totalBlocks = (int)fs.sb->totalBlocks;
+    fs.bitmapWords = (fs.totalBlocks + 63) / 64;
+    fs.summaryWords = (fs.bitmapWords + 63) / 64;
+    fs.usedMap = (uint64_t *)(fs.image + fs.sb->bitmapOffset);
+    fs.fullSummary = (uint64_t *)(fs.image + fs.sb->summaryOffset);
+    fs.inodeMap = (uint64_t *)(fs.image + fs.sb->inodeMapOffset);
+    fs.inodes = (DiskInode *)(fs.image + fs.sb->inodeOffset);
+    fs.dedup = (fs.sb->features & FEATURE_DEDUP) != 0;
+    fs.blockInfo = fs.dedup ? (BlockInfo *)(fs.image + fs.sb->blockInfoOffset) : NULL;
+    fs.data = data;
+}
+
+/* map the image at `path`, formatting it if it is new or empty, or an
+   anonymous image when path is NULL. a new image gets the requested
+   geometry (0 = default); an existing one keeps its own, and asking for a
+   different one is an error. the inode table is sized from the geometry,
+   and generously for an anonymous image. the image is sparse: the file
+   is sized with ftruncate and the mapping reserves nothing, so blocks
+   take space only once written. an image file's journal is replayed first; its metadata
+   is then mapped privately and its data blocks shared. dedup (fs.dedup
+   on entry) is likewise fixed at format. mounting reads only the
+   superblock and the root inode; the rest is paged in on use */
+static void mountImage(const char *path, int blockSize, int totalBlocks) {
+    SuperBlock layout;
+    int bs = blockSize ? blockSize : DEFAULT_BLOCK_SIZE;
+    int blocks = totalBlocks ? totalBlocks : DEFAULT_TOTAL_BLOCKS;
+    layoutImage(&layout, bs, blocks, inodesFor(bs, blocks, path == NULL), fs.dedup ? FEATURE_DEDUP : 0);
+    bool format = true;
+    uint64_t seq = 1;
+
+    fs.imageFd = -1;
+    if (path) {
+        fs.imageFd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fs.imageFd < 0) die("cannot open disk image");
+        struct stat st;
+        if (fstat(fs.imageFd, &st) < 0) die("cannot open disk image");
+        if (st.st_size > 0) {
+            SuperBlock sb;
+            if (pread(fs.imageFd, &sb, sizeof(sb), 0) != (ssize_t)sizeof(sb) ||
+                memcmp(sb.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 ||
+                sb.version != IMAGE_VERSION)
+                die("not a VFS disk image");
+            SuperBlock expect;
+            bool sane = validGeometry(sb.blockSize, sb.totalBlocks) &&
+                        sb.inodeCount > 0 && sb.inodeCount <= MAX_INODES && sb.inodeCount % 64 == 0;
+            if (sane) layoutImage(&expect, (int)sb.blockSize, (int)sb.totalBlocks, sb.inodeCount, sb.features);
+            if (!sane || expect.journalOffset != sb.journalOffset || expect.imageSize != sb.imageSize ||
+                (uint64_t)st.st_size < sb.imageSize)
+                die("corrupt disk image");
+            if ((blockSize && (uint32_t)blockSize != sb.blockSize) ||
+                (totalBlocks && (uint32_t)totalBlocks != sb.totalBlocks))
+                die("disk image geometry does not match");
+            if (fs.dedup && !(sb.features & FEATURE_DEDUP))
+                die("dedup must be enabled when the image is formatted");
+            layout = sb;
+            format = false;
+            seq = journalReplay(&sb);
+        } else if (ftruncate(fs.imageFd, (off_t)layout.imageSize) < 0) {
+            die("cannot size disk image");
+        } else {
+            writeJournalHeader(layout.journalOffset, seq);
+        }
+        fs.imageSize = layout.journalOffset;
+        fs.dataSize = layout.imageSize - layout.dataOffset;
+        fs.image = mmap(NULL, fs.imageSize, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_NORESERVE, fs.imageFd, 0);
+        fs.dataMap = mmap(NULL, fs.dataSize, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_NORESERVE, fs.imageFd, (off_t)layout.dataOffset);
+        if (fs.image == MAP_FAILED || fs.dataMap == MAP_FAILED) die("cannot map disk image");
+    } else {
+        fs.imageSize = layout.imageSize;
+        fs.image = mmap(NULL, fs.imageSize, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (fs.image == MAP_FAILED) die("cannot map disk image");
+        fs.dataMap = NULL;
+    }
+
+    if (format) memcpy(fs.image, &layout, sizeof(layout));
+    mapRegions(fs.dataMap ? fs.dataMap : fs.image + layout.dataOffset);
+    if (fs.imageFd >= 0) journalStart(seq);
+
+    if (format) {
+        metaTouch(fs.sb, sizeof(SuperBlock));
+        /* the mapping starts zeroed, i.e. every block and inode free; only
+           the bits past the last block, in the last map and summary words,
+           need setting */
+        fs.freeCount = fs.totalBlocks;
+        if (fs.bitmapWords * 64 > fs.totalBlocks)
+            setUsedBits(fs.totalBlocks, fs.bitmapWords * 64 - fs.totalBlocks, true);
+        if (fs.summaryWords * 64 > fs.bitmapWords) {
+            fs.fullSummary[fs.summaryWords - 1] |= ~bitRange(0, fs.bitmapWords % 64);
+            metaTouch(&fs.fullSummary[fs.summaryWords - 1], sizeof(uint64_t));
+        }
+        fs.sb->freeInodes = fs.sb->inodeCount;
+        fs.inodeHint = 0;
+        allocInode();               /* ROOT_INO */
+        safe_strcpy(fs.inodes[ROOT_INO].name, "/");
+        fs.inodes[ROOT_INO].flags |= INODE_DIR;
+        fs.sb->freeCount = (uint32_t)fs.freeCount;
+        journalCommit();
+        if (fs.imageFd >= 0) imageSync();
+    } else {
+        fs.freeCount = (int)fs.sb->freeCount;
+        fs.logicalBlocks = fs.sb->logicalBlocks;
+        fs.inodeHint = 0;
+    }
+}
+
+/* commit what is left and checkpoint, so the next mount has nothing to
+   replay */
+static void unmountImage(void) {
+    syncMetadata();
+    if (fs.imageFd >= 0) {
+        journalCommit();
+        msync(fs.dataMap, fs.dataSize, MS_SYNC);
+        journalCheckpoint();
+        journalStop();
+        munmap(fs.dataMap, fs.dataSize);
+        close(fs.imageFd);
+    }
+    munmap(fs.image, fs.imageSize);
+    fs.image = NULL;
+}
+
+/* ---------- Paths ---------- */
+
+/* absolute path of a directory, "" for the root so that a child's path is
+   always parent path + "/" + name. cached per directory and rebuilt lazily
+   once a rename has moved or renamed some directory */
+static const char *dirPath(FileNode *d) {
+    if (d == fs.root) return "";
+    if (!d->path || d->pathGen != fs.pathGen) {
+        const char *parentPath = dirPath(d->parent);
+        size_t n = strlen(parentPath) + strlen(d->name) + 2;
+        char *p = realloc(d->path, n);
+        if (!p) die("realloc failed");
+        snprintf(p, n, "%s/%s", parentPath, d->name);
+        d->path = p;
+        d->pathGen = fs.pathGen;
+    }
+    return d->path;
+}
+
+/* lexically normalise `path` against the cwd into an absolute path with no
+   ".", ".." or repeated slashes ("/" for the root). false if a component
+   is too long or the result does not fit */
+static bool canonicalPath(const char *path, char *out) {
+    size_t len = 0;
+    if (path[0] != '/') {
+        const char *cwd = dirPath(fs.cwd);
+        len = strlen(cwd);
+        if (len + 1 > PATH_LIMIT) return false;
+        memcpy(out, cwd, len);
+    }
+    while (*path) {
+        while (*path == '/') ++path;
+        const char *end = path;
+        while (*end && *end != '/') ++end;
+        size_t n = (size_t)(end - path);
+        if (n == 0 || (n == 1 && path[0] == '.')) {
+            /* nothing */
+        } else if (n == 2 && path[0] == '.' && path[1] == '.') {
+            while (len > 0 && out[len - 1] != '/') --len;
+            if (len > 0) --len;
+        } else {
+            if (n > NAME_LIMIT || len + n + 2 > PATH_LIMIT) return false;
+            out[len++] = '/';
+            memcpy(out + len, path, n);
+            len += n;
+        }
+        path = end;
+    }
+    if (len == 0) out[len++] = '/';
+    out[len] = '\0';
+    return true;
+}
+
+/* does `node` live at absolute path `canon` right now? */
+static bool nodeHasPath(FileNode *node, const char *canon) {
+    if (!node->parent) return false;
+    const char *dir = dirPath(node->parent);
+    size_t dl = strlen(dir);
+    return strncmp(canon, dir, dl) == 0 && canon[dl] == '/' &&
+           strcmp(canon + dl + 1, node->name) == 0;
+}
+
+static DentryCache *dcacheSlot(const char *canon, uint32_t *hash) {
+    *hash = hashName(canon);
+    return &fs.dcache[*hash & (DCACHE_SIZE - 1)];
+}
+
+/* forget the cached lookup of a node that is about to move or be freed */
+static void dcacheForget(FileNode *node) {
+    char canon[PATH_LIMIT];
+    uint32_t h;
+    snprintf(canon, sizeof(canon), "%s/%s", dirPath(node->parent), node->name);
+    DentryCache *slot = dcacheSlot(canon, &h);
+    if (slot->node == node) slot->node = NULL;
+}
+
+/* resolve an absolute or cwd-relative path to its node, or NULL. a cached
+   slot is only trusted if the node still sits at that path, so renames
+   and moves of any ancestor cannot return a stale answer */
+static FileNode *lookupPath(const char *path) {
+    char canon[PATH_LIMIT];
+    if (!canonicalPath(path, canon)) return NULL;
+    if (strcmp(canon, "/") == 0) return fs.root;
+
+    uint32_t h;
+    DentryCache *slot = dcacheSlot(canon, &h);
+    if (slot->node && slot->hash == h && nodeHasPath(slot->node, canon)) return slot->node;
+
+    FileNode *cur = fs.root;
+    char name[NAME_LIMIT + 1];
+    for (const char *p = canon + 1; cur; ) {
+        const char *end = strchr(p, '/');
+        size_t n = end ? (size_t)(end - p) : strlen(p);
+        memcpy(name, p, n);
+        name[n] = '\0';
+        if (!cur->isDir) return NULL;
+        cur = findChild(cur, name);
+        if (!end) break;
+        p = end + 1;
+    }
+    if (cur) {
+        slot->hash = h;
+        slot->node = cur;
+    }
+    return cur;
+}
+
+/* split `path` into its existing parent directory and final name. returns
+   the parent, or NULL if it does not exist (or is a file); `leaf` is ""
+   for the root */
+static FileNode *lookupParent(const char *path, char *leaf) {
+    char canon[PATH_LIMIT];
+    leaf[0] = '\0';
+    if (!canonicalPath(path, canon)) return NULL;
+    if (strcmp(canon, "/") == 0) return fs.root;
+
+    char *slash = strrchr(canon, '/');
+    strcpy(leaf, slash + 1);
+    if (slash == canon) return fs.root;
+    *slash = '\0';
+    FileNode *parent = lookupPath(canon);
+    return (parent && parent->isDir) ? parent : NULL;
+}
+
+/* ---------- Block deduplication ---------- */
+
+/* In dedup mode every data block carries a reference count and a content
+   fingerprint. a block about to be written is first looked up by
+   fingerprint (and compared byte for byte); a match is shared instead of
+   stored again. a block owned by one file is rewritten in place, a shared
+   one is copied first. blocks go back to the free map when their last
+   reference is dropped */
+
+static uint32_t dedupHome(uint64_t fp) {
+    return (uint32_t)(fp ^ (fp >> 32)) & fs.dedupMask;
+}
+
+/* a block holding exactly `blk`, or -1. every block is indexed under its
+   fingerprint, so all of a fingerprint's blocks sit in one probe run and
+   each is compared until one matches */
+static int dedupFind(uint64_t fp, const unsigned char *blk) {
+    for (uint32_t i = dedupHome(fp); fs.dedupIndex[i].block >= 0; i = (i + 1) & fs.dedupMask) {
+        int b = fs.dedupIndex[i].block;
+        if (fs.dedupIndex[i].fingerprint == fp && memcmp(blockData(b), blk, (size_t)fs.blockSize) == 0)
+            return b;
+    }
+    return -1;
+}
+
+static void dedupPut(uint64_t fp, int block) {
+    uint32_t i = dedupHome(fp);
+    while (fs.dedupIndex[i].block >= 0) i = (i + 1) & fs.dedupMask;
+    fs.dedupIndex[i].fingerprint = fp;
+    fs.dedupIndex[i].block = block;
+    fs.dedupCount++;
+}
+
+static void dedupResize(uint32_t slots) {
+    DedupSlot *old = fs.dedupIndex;
+    uint32_t oldSlots = old ? fs.dedupMask + 1 : 0;
+    fs.dedupIndex = malloc(sizeof(DedupSlot) * slots);
+    if (!fs.dedupIndex) die("malloc failed");
+    for (uint32_t i = 0; i < slots; ++i) fs.dedupIndex[i].block = -1;
+    fs.dedupMask = slots - 1;
+    fs.dedupCount = 0;
+    for (uint32_t i = 0; i < oldSlots; ++i)
+        if (old[i].block >= 0) dedupPut(old[i].fingerprint, old[i].block);
+    free(old);
+}
+
+static void dedupInsert(uint64_t fp, int block) {
+    if ((fs.dedupCount + 1) * 2 > fs.dedupMask + 1) dedupResize((fs.dedupMask + 1) * 2);
+    dedupPut(fp, block);
+}
+
+/* linear probing with backward-shift deletion, so no tombstones */
+static void dedupRemove(uint64_t fp, int block) {
+    uint32_t i = dedupHome(fp);
+    while (fs.dedupIndex[i].block != block) {
+        if (fs.dedupIndex[i].block < 0) return;
+        i = (i + 1) & fs.dedupMask;
+    }
+    for (uint32_t j = (i + 1) & fs.dedupMask; fs.dedupIndex[j].block >= 0; j = (j + 1) & fs.dedupMask) {
+        uint32_t home = dedupHome(fs.dedupIndex[j].fingerprint);
+        if (((j - home) & fs.dedupMask) >= ((j - i) & fs.dedupMask)) {
+            fs.dedupIndex[i] = fs.dedupIndex[j];
+            i = j;
+        }
+    }
+    fs.dedupIndex[i].block = -1;
+    fs.dedupCount--;
+}
+
+/* build the index from the fingerprints in the block info table the first
+   time a write needs it, skipping free words of the used map */
+static void dedupLoad(void) {
+    if (fs.dedupIndex) return;
+    dedupResize(1024);
+    for (int w = 0; w < fs.bitmapWords; ++w) {
+        for (uint64_t bits = fs.usedMap[w]; bits; bits &= bits - 1) {
+            int b = w * 64 + __builtin_ctzll(bits);
+            if (b >= fs.totalBlocks) break;
+            const BlockInfo *bi = &fs.blockInfo[b];
+            if (bi->refs > 0 && bi->fingerprint) dedupInsert(bi->fingerprint, b);
+        }
+    }
+}
+
+static void blockRef(int b) {
+    fs.blockInfo[b].refs++;
+    metaTouch(&fs.blockInfo[b], sizeof(BlockInfo));
+    fs.logicalBlocks++;
+}
+
+static void blockUnref(int b) {
+    BlockInfo *bi = &fs.blockInfo[b];
+    metaTouch(bi, sizeof(*bi));
+    fs.logicalBlocks--;
+    if (--bi->refs > 0) return;
+    if (bi->fingerprint && fs.dedupIndex) dedupRemove(bi->fingerprint, b);
+    bi->fingerprint = 0;
+    markBlocks(b, 1, true);
+}
+
+/* release a run of a file's blocks: free them, or in dedup mode drop one
+   reference from each */
+static void dropBlocks(int start, int count) {
+    if (!fs.dedup) { markBlocks(start, count, true); return; }
+    for (int b = start; b < start + count; ++b) blockUnref(b);
+}
+
+/* physical block behind logical block i of a file */
+static int fileBlock(const FileNode *f, int i) {
+    for (int e = 0; e < f->extentCount; ++e) {
+        if (i < f->extents[e].length) return f->extents[e].start + i;
+        i -= f->extents[e].length;
+    }
+    return -1;
+}
+
+/* point logical block i (at most blockCount) at physical block p, splitting
+   the extent that held the old block */
+static void mapFileBlock(FileNode *f, int i, int p) {
+    if (i == f->blockCount) { appendExtent(f, p, 1); return; }
+    int e = 0;
+    while (i >= f->extents[e].length) i -= f->extents[e++].length;
+    Extent x = f->extents[e];
+    Extent parts[3];
+    int n = 0;
+    if (i > 0) parts[n++] = (Extent){ x.start, i };
+    parts[n++] = (Extent){ p, 1 };
+    if (i < x.length - 1) parts[n++] = (Extent){ x.start + i + 1, x.length - i - 1 };
+
+    if (f->extentCount + n - 1 > f->extentCap) {
+        int cap = f->extentCap * 2 > f->extentCount + 2 ? f->extentCap * 2 : f->extentCount + 2;
+        Extent *tmp = realloc(f->extents, sizeof(Extent) * cap);
+        if (!tmp) die("realloc failed");
+        f->extents = tmp;
+        f->extentCap = cap;
+    }
+    memmove(&f->extents[e + n], &f->extents[e + 1], sizeof(Extent) * (f->extentCount - e - 1));
+    memcpy(&f->extents[e], parts, sizeof(Extent) * n);
+    f->extentCount += n - 1;
+}
+
+/* store `blk` as logical block i of a file, whose current block is `old`
+   (-1 past the end): share an identical block, rewrite a block the file
+   owns alone, or copy on write */
+static void placeBlock(FileNode *f, int i, int old, const unsigned char *blk) {
+    size_t bs = (size_t)fs.blockSize;
+    uint64_t fp = checksum64(blk, bs);
+    if (fp == 0) fp = 1;
+    int match = dedupFind(fp, blk);
+
+    if (match >= 0) {
+        if (match == old) return;
+        blockRef(match);
+        mapFileBlock(f, i, match);
+        if (old >= 0) blockUnref(old);
+        return;
+    }
+    if (old >= 0 && fs.blockInfo[old].refs == 1) {
+        BlockInfo *bi = &fs.blockInfo[old];
+        if (bi->fingerprint) dedupRemove(bi->fingerprint, old);
+        memcpy(blockData(old), blk, bs);
+        bi->fingerprint = fp;
+        metaTouch(bi, sizeof(*bi));
+        dedupInsert(fp, old);
+        return;
+    }
+
+    /* a new block, next to the previous one when that is free */
+    int got, b = 0;
+    int prev = (i > 0) ? fileBlock(f, i - 1) : -1;
+    if (prev < 0 || claimRunAt(prev + 1, 1) == 0) b = allocRun(1, &got);
+    else b = prev + 1;
+    if (b < 0) die("dedup: no free block after reserving one");
+    memcpy(blockData(b), blk, bs);
+    fs.blockInfo[b].fingerprint = fp;
+    fs.blockInfo[b].refs = 0;
+    blockRef(b);
+    dedupInsert(fp, b);
+    mapFileBlock(f, i, b);
+    if (old >= 0) blockUnref(old);
+}
+
+/* dedup form of writeAt: rebuild each block the write touches, including
+   a zero-filled gap from the old end, and place it. buf NULL writes
+   zeros. fails up front, leaving the file alone, unless the disk could
+   take a fresh block for every touched block that is shared or new, and
+   the inode table the records for every touched block splitting off an
+   extent of its own */
+static int dedupWrite(FileNode *f, uint64_t off, const char *buf, uint64_t len) {
+    uint64_t bs = (uint64_t)fs.blockSize, oldSize = f->size, end = off + len;
+    uint64_t from = off < oldSize ? off : oldSize;
+    if (end <= from) return WRITE_OK;
+    int first = (int)(from / bs), last = (int)((end - 1) / bs);
+
+    int worst = 0;
+    for (int i = first; i <= last; ++i)
+        if (i >= f->blockCount || fs.blockInfo[fileBlock(f, i)].refs > 1) ++worst;
+    if (worst > fs.freeCount - fs.pendingBlocks) {
+        if (fs.pendingCount > 0) fs.commitSoon = true;
+        return WRITE_NO_SPACE;
+    }
+    int blocks = last + 1 > f->blockCount ? last + 1 : f->blockCount;
+    int extents = f->extentCount + 2 * (last - first + 1);
+    if (!reserveRecords(f, extents < blocks ? extents : blocks)) return WRITE_NO_INODES;
+
+    dedupLoad();
+    if (!fs.dedupBuf && !(fs.dedupBuf = malloc(bs))) die("malloc failed");
+    unsigned char *blk = fs.dedupBuf;
+    for (int i = first; i <= last; ++i) {
+        uint64_t at = (uint64_t)i * bs;
+        int old = (i < f->blockCount) ? fileBlock(f, i) : -1;
+        size_t keep = (old >= 0 && oldSize > at) ? (size_t)(oldSize - at < bs ? oldSize - at : bs) : 0;
+        if (keep) memcpy(blk, blockData(old), keep);
+        memset(blk + keep, 0, bs - keep);
+        uint64_t lo = off > at ? off : at, hi = end < at + bs ? end : at + bs;
+        if (lo < hi) {
+            if (buf) memcpy(blk + (lo - at), buf + (lo - off), hi - lo);
+            else memset(blk + (lo - at), 0, hi - lo);
+        }
+        placeBlock(f, i, old, blk);
+    }
+    if (end > oldSize) f->size = end;
+    return WRITE_OK;
+}
+
+/* ---------- File data ---------- */
+
+enum { SPAN_READ, SPAN_WRITE, SPAN_ZERO };
+
+/* apply `op` to bytes [off, off + len) of a file's blocks, one contiguous
+   piece per extent: copy them to stdout, fill them from src, or zero them */
+static void fileSpan(FileNode *f, uint64_t off, uint64_t len, int op, const char *src) {
+    uint64_t bs = (uint64_t)fs.blockSize, extOff = 0;
+    for (int e = 0; e < f->extentCount && len > 0; ++e) {
+        const Extent *x = &f->extents[e];
+        uint64_t extBytes = (uint64_t)x->length * bs;
+        if (off >= extOff + extBytes) { extOff += extBytes; continue; }
+        uint64_t within = off - extOff;
+        size_t n = (size_t)((extBytes - within < len) ? extBytes - within : len);
+        unsigned char *p = blockData(x->start) + within;
+        if (op == SPAN_READ) fwrite(p, 1, n, stdout);
+        else if (op == SPAN_WRITE) { memcpy(p, src, n); src += n; }
+        else memset(p, 0, n);
+        off += n;
+        len -= n;
+        extOff += extBytes;
+    }
+}
+
+/* give the file at least `blocks` blocks, extending its last extent in
+   place when the blocks after it are free. a run that starts a new extent
+   first gets its overflow record, if it needs one. on a full disk or
+   inode table the file is left as it was */
+static int growFile(FileNode *f, int blocks) {
+    int had = f->blockCount;
+    while (f->blockCount < blocks) {
+        int want = blocks - f->blockCount, got = 0, start = -1, tail = -1;
+        if (f->extentCount > 0) {
+            const Extent *last = &f->extents[f->extentCount - 1];
+            start = tail = last->start + last->length;
+            got = claimRunAt(start, want);
+        }
+        if (got == 0) start = allocRun(want, &got);
+        if (start == -1) {
+            truncateExtents(f, had);
+            return WRITE_NO_SPACE;
+        }
+        if (start != tail && !reserveRecords(f, f->extentCount + 1)) {
+            markBlocks(start, got, true);
+            truncateExtents(f, had);
+            return WRITE_NO_INODES;
+        }
+        appendExtent(f, start, got);
+    }
+    return WRITE_OK;
+}
+
+static int blocksFor(uint64_t bytes) {
+    uint64_t bs = (uint64_t)fs.blockSize;
+    uint64_t n = (bytes + bs - 1) / bs;
+    return n > (uint64_t)fs.totalBlocks ? fs.totalBlocks + 1 : (int)n;
+}
+
+/* set the file length; new bytes read as zero. shrinking always succeeds.
+   bytes past the end of the last block are never read, so shrinking only
+   releases blocks and growing zeroes from the old end */
+static int setFileSize(FileNode *f, uint64_t size) {
+    int need = blocksFor(size);
+    if (size > f->size) {
+        if (need > fs.totalBlocks) return WRITE_NO_SPACE;
+        if (fs.dedup) return dedupWrite(f, f->size, NULL, size - f->size);
+        int err = growFile(f, need);
+        if (err) return err;
+        fileSpan(f, f->size, size - f->size, SPAN_ZERO, NULL);
+    } else {
+        truncateExtents(f, need);
+    }
+    f->size = size;
+    return WRITE_OK;
+}
+
+/* write `len` bytes at `off`, allocating blocks only past the end of the
+   file; a hole between the old end and `off` reads as zero. the file is
+   left unchanged when the blocks or their records are not available */
+static int writeAt(FileNode *f, uint64_t off, const char *buf, size_t len) {
+    if (fs.dedup) return dedupWrite(f, off, buf, len);
+    uint64_t end = off + len;
+    if (end > f->size) {
+        int need = blocksFor(end);
+        if (need > fs.totalBlocks) return WRITE_NO_SPACE;
+        int err = growFile(f, need);
+        if (err) return err;
+        if (off > f->size) fileSpan(f, f->size, off - f->size, SPAN_ZERO, NULL);
+        f->size = end;
+    }
+    fileSpan(f, off, len, SPAN_WRITE, buf);
+    return WRITE_OK;
+}
+
+/* ---------- Commands (preserve exact wording) ---------- */
+
+/* report why writeAt or setFileSize failed */
+static void writeFailed(int err, const char *what) {
+    if (err == WRITE_NO_INODES) printf("No free inodes.\n");
+    else printf("%s failed: disk full.\n", what);
+}
+
+static FileNode *makeEntry(const char *path, bool isDir) {
+    char name[PATH_LIMIT];
+    FileNode *parent = lookupParent(path, name);
+    if (!valid_name(name)) { printf("Invalid name.\n"); return NULL; }
+    if (!parent) { printf("Directory not found.\n"); return NULL; }
+    if (findChild(parent, name)) { printf("Entry with name '%s' already exists.\n", name); return NULL; }
+    uint32_t ino = allocInode();
+    if (ino == NO_INO) { printf("No free inodes.\n"); return NULL; }
     FileNode *n = malloc(sizeof(FileNode));
     if (!n) die("malloc failed");
-    initFileNode(n, name, false);
-    insertChild(fs.cwd, n);
-    printf("File '%s' created successfully.\n", name);
+    initFileNode(n, name, isDir);
+    n->ino = ino;
+    insertChild(parent, n);
+    return n;
+}
+
+static void mkdirCmd(const char *path) {
+    FileNode *n = makeEntry(path, true);
+    if (n) printf("Directory '%s' created successfully.\n", n->name);
 }
 
+static void createCmd(const char *path) {
+    FileNode *n = makeEntry(path, false);
+    if (n) printf("File '%s' created successfully.\n", n->name);
+}
+
+/* resolve a path to a file ready for data access, or print why not */
+static FileNode *openFile(const char *name) {
+    FileNode *f = lookupPath(name);
+    if (!f) { printf("File not found.\n"); return NULL; }
+    if (f->isDir) { printf("'%s' is a directory.\n", name); return NULL; }
+    loadNode(f);
+    return f;
+}
+
+/* replace the whole contents; blocks the file already has are reused in
+   place and only the shortfall is allocated */
 static void writeCmd(const char *name, const char *data) {
-    FileNode *f = findChild(fs.cwd, name);
-    if (!f) { printf("File not found.\n"); return; }
-    if (f->isDir) { printf("'%s' is a directory.\n", name); return; }
+    FileNode *f = openFile(name);
+    if (!f) return;
 
     size_t len = strlen(data);
-    size_t totalBytes = len + 1; /* include NUL to make read simpler */
-    int required = (int)((totalBytes + BLOCK_SIZE - 1) / BLOCK_SIZE);
-    if (required > TOTAL_BLOCKS) { printf("Data too large.\n"); return; }
-
-    /* free old blocks */
-    for (int i = 0; i < f->blockCount; ++i) freeBlock(f->blockPointers[i]);
-    f->blockCount = 0;
-
-    ensureBlockCapacity(f, required);
-
-    size_t offset = 0;
-    for (int i = 0; i < required; ++i) {
-        int blk = allocBlock();
-        if (blk == -1) {
-            /* rollback */
-            for (int j = 0; j < f->blockCount; ++j) freeBlock(f->blockPointers[j]);
-            f->blockCount = 0;
-            printf("Write failed: disk full.\n");
-            return;
-        }
-        f->blockPointers[f->blockCount++] = blk;
-        size_t toCopy = (totalBytes - offset > BLOCK_SIZE) ? BLOCK_SIZE : (totalBytes - offset);
-        memcpy(fs.disk[blk], data + offset, toCopy);
-        if (toCopy < BLOCK_SIZE) memset(fs.disk[blk] + toCopy, 0, BLOCK_SIZE - toCopy);
-        offset += toCopy;
+    if (blocksFor(len) > fs.totalBlocks) { printf("Data too large.\n"); return; }
+
+    markDirty(f);
+    if (f->size > len) setFileSize(f, len);
+    int err = writeAt(f, 0, data, len);
+    if (err) {
+        /* rollback */
+        setFileSize(f, 0);
+        writeFailed(err, "Write");
+        return;
     }
+    printf("Data written successfully (size=%zu bytes).\n", len);
+}
 
+static void pwriteCmd(const char *name, uint64_t offset, const char *data) {
+    FileNode *f = openFile(name);
+    if (!f) return;
+
+    size_t len = strlen(data);
+    if (offset > UINT64_MAX - len || blocksFor(offset + len) > fs.totalBlocks) {
+        printf("Data too large.\n");
+        return;
+    }
+    markDirty(f);
+    int err = writeAt(f, offset, data, len);
+    if (err) { writeFailed(err, "Write"); return; }
     printf("Data written successfully (size=%zu bytes).\n", len);
 }
 
+static void appendCmd(const char *name, const char *data) {
+    FileNode *f = openFile(name);
+    if (!f) return;
+
+    size_t len = strlen(data);
+    if (blocksFor(f->size + len) > fs.totalBlocks) { printf("Data too large.\n"); return; }
+    markDirty(f);
+    int err = writeAt(f, f->size, data, len);
+    if (err) { writeFailed(err, "Write"); return; }
+    printf("Data appended successfully (size=%llu bytes).\n", (unsigned long long)f->size);
+}
+
+static void truncateCmd(const char *name, uint64_t size) {
+    FileNode *f = openFile(name);
+    if (!f) return;
+
+    if (blocksFor(size) > fs.totalBlocks) { printf("Data too large.\n"); return; }
+    markDirty(f);
+    int err = setFileSize(f, size);
+    if (err) { writeFailed(err, "Truncate"); return; }
+    printf("File truncated to %llu bytes.\n", (unsigned long long)size);
+}
+
 static void readCmd(const char *name) {
-    FileNode *f = findChild(fs.cwd, name);
-    if (!f) { printf("File not found.\n"); return; }
-    if (f->isDir) { printf("'%s' is a directory.\n", name); return; }
-    if (f->blockCount == 0) { printf("File is empty.\n"); return; }
+    FileNode *f = openFile(name);
+    if (!f) return;
+    if (f->size == 0) { printf("File is empty.\n"); return; }
 
-    for (int i = 0; i < f->blockCount; ++i) {
-        if (i < f->blockCount - 1) {
-            fwrite(fs.disk[f->blockPointers[i]], 1, BLOCK_SIZE, stdout);
-        } else {
-            char *blk = (char *)fs.disk[f->blockPointers[i]];
-            size_t n = strnlen(blk, BLOCK_SIZE);
-            fwrite(blk, 1, n, stdout);
-        }
+    fileSpan(f, 0, f->size, SPAN_READ, NULL);
+    printf("\n");
+}
+
+/* bytes [offset, offset + length) clipped to the end of the file */
+static void preadCmd(const char *name, uint64_t offset, uint64_t length) {
+    FileNode *f = openFile(name);
+    if (!f) return;
+
+    if (offset < f->size) {
+        uint64_t avail = f->size - offset;
+        fileSpan(f, offset, length < avail ? length : avail, SPAN_READ, NULL);
     }
     printf("\n");
 }
 
 static void deleteCmd(const char *name) {
-    FileNode *f = findChild(fs.cwd, name);
+    FileNode *f = lookupPath(name);
     if (!f) { printf("File not found.\n"); return; }
     if (f->isDir) { printf("'%s' is a directory. Use rmdir to remove directories.\n", name); return; }
 
+    dcacheForget(f);
     unlinkNode(f);
-    for (int i = 0; i < f->blockCount; ++i) freeBlock(f->blockPointers[i]);
-    free(f->blockPointers);
-    free(f);
+    releaseNode(f);
     printf("File deleted successfully.\n");
 }
 
 static void rmdirCmd(const char *name) {
-    FileNode *d = findChild(fs.cwd, name);
+    FileNode *d = lookupPath(name);
     if (!d) { printf("Directory not found.\n"); return; }
     if (!d->isDir) { printf("'%s' is not a directory.\n", name); return; }
+    loadNode(d);
     if (d->child) { printf("Directory not empty.\n"); return; }
+    if (d == fs.root || d == fs.cwd) { printf("Cannot remove the current directory.\n"); return; }
 
+    dcacheForget(d);
     unlinkNode(d);
-    free(d);
+    releaseNode(d);
     printf("Directory removed successfully.\n");
 }
 
-static void lsCmd(void) {
-    if (!fs.cwd->child) { printf("(empty)\n"); return; }
-    FileNode *t = fs.cwd->child;
+/* length of the longest path below a directory, relative to it, over the
+   entries loaded so far. the rest can only be reached through a lookup,
+   which refuses paths past PATH_LIMIT */
+static size_t loadedDepth(FileNode *d) {
+    if (!d->isDir || !d->loaded || !d->child) return 0;
+    size_t deepest = 0;
+    FileNode *t = d->child;
+    do {
+        size_t n = 1 + strlen(t->name) + loadedDepth(t);
+        if (n > deepest) deepest = n;
+        t = t->next;
+    } while (t != d->child);
+    return deepest;
+}
+
+/* rename <path> <newpath>: renames and/or moves a file or directory */
+static void renameCmd(const char *from, const char *to) {
+    FileNode *n = lookupPath(from);
+    if (!n) { printf("File not found.\n"); return; }
+    if (n == fs.root) { printf("Invalid name.\n"); return; }
+
+    char name[PATH_LIMIT];
+    FileNode *parent = lookupParent(to, name);
+    if (!valid_name(name)) { printf("Invalid name.\n"); return; }
+    if (!parent) { printf("Directory not found.\n"); return; }
+    FileNode *existing = findChild(parent, name);
+    if (existing == n) { printf("Renamed successfully.\n"); return; }
+    if (existing) { printf("Entry with name '%s' already exists.\n", name); return; }
+    for (FileNode *a = parent; a; a = a->parent)
+        if (a == n) { printf("Cannot move a directory into itself.\n"); return; }
+    /* a longer directory path lengthens every path below it, the cwd's and
+       the cached ones included; none may outgrow PATH_LIMIT */
+    if (n->isDir) {
+        size_t to = strlen(dirPath(parent)) + 1 + strlen(name);
+        if (to > strlen(dirPath(n)) && to + loadedDepth(n) + 1 > PATH_LIMIT) {
+            printf("Path too long.\n");
+            return;
+        }
+    }
+
+    dcacheForget(n);
+    unlinkNode(n);
+    safe_strcpy(n->name, name);
+    n->nameHash = hashName(n->name);
+    insertChild(parent, n);     /* also queues n for its new name and parent */
+    /* every path under a directory just changed: rebuild the cached
+       directory paths on demand and start the lookup cache over */
+    if (n->isDir) {
+        fs.pathGen++;
+        memset(fs.dcache, 0, sizeof(fs.dcache));
+    }
+    printf("Renamed successfully.\n");
+}
+
+static void lsCmd(const char *path) {
+    FileNode *d = path ? lookupPath(path) : fs.cwd;
+    if (!d || !d->isDir) { printf("Directory not found.\n"); return; }
+    loadNode(d);
+    if (!d->child) { printf("(empty)\n"); return; }
+    FileNode *t = d->child;
     do {
         printf("%s%s\n", t->name, t->isDir ? "/" : "");
         t = t->next;
-    } while (t != fs.cwd->child);
+    } while (t != d->child);
 }
 
 static void cdCmd(const char *name) {
@@ -288,85 +1842,109 @@ static void cdCmd(const char *name) {
         printf("Moved to %s\n", fs.cwd->name);
         return;
     }
-    FileNode *d = findChild(fs.cwd, name);
+    FileNode *d = lookupPath(name);
     if (!d || !d->isDir) { printf("Directory not found.\n"); return; }
     fs.cwd = d;
     /* print path as in sample: Moved to /docs */
-    if (fs.cwd == fs.root) printf("Moved to /\n");
-    else {
-        /* build path */
-        char path[4096] = {0};
-        const FileNode *stack[1024];
-        int top = 0;
-        const FileNode *cur = fs.cwd;
-        while (cur && cur->parent) {
-            stack[top++] = cur;
-            cur = cur->parent;
-            if (top >= 1023) break;
-        }
-        strcat(path, "");
-        for (int i = top - 1; i >= 0; --i) {
-            strcat(path, "/");
-            strcat(path, stack[i]->name);
-        }
-        printf("Moved to %s\n", path);
-    }
+    printf("Moved to %s\n", fs.cwd == fs.root ? "/" : dirPath(fs.cwd));
 }
 
 static void pwdCmd(FileNode *d) {
     if (!d) return;
-    if (d == fs.root) { printf("/"); return; }
-
-    const FileNode *stack[1024];
-    int top = 0;
-    const FileNode *cur = d;
-    while (cur && cur->parent) {
-        stack[top++] = cur;
-        cur = cur->parent;
-        if (top >= 1023) break;
-    }
-    for (int i = top - 1; i >= 0; --i) {
-        printf("/%s", stack[i]->name);
-    }
+    printf("%s", d == fs.root ? "/" : dirPath(d));
 }
 
 static void dfCmd(void) {
-    int used = TOTAL_BLOCKS - fs.freeCount;
-    printf("Total Blocks: %d\n", TOTAL_BLOCKS);
+    int used = fs.totalBlocks - fs.freeCount;
+    printf("Total Blocks: %d\n", fs.totalBlocks);
     printf("Used Blocks: %d\n", used);
     printf("Free Blocks: %d\n", fs.freeCount);
-    printf("Disk Usage: %.2f%%\n", 100.0 * used / TOTAL_BLOCKS);
+    printf("Disk Usage: %.2f%%\n", 100.0 * used / fs.totalBlocks);
+    if (fs.dedup) {
+        printf("Logical Blocks: %llu\n", (unsigned long long)fs.logicalBlocks);
+        printf("Physical Blocks: %d\n", used);
+        printf("Dedup Ratio: %.2fx\n", used ? (double)fs.logicalBlocks / used : 1.0);
+    }
+}
+
+/* commit the open journal transaction now instead of at the batch end */
+static void syncCmd(void) {
+    syncMetadata();
+    journalCommit();
+    printf("Sync complete.\n");
+}
+
+static void journalCmd(void) {
+    if (!fs.journaling) { printf("Journal: off (in-memory image)\n"); return; }
+    const JournalStats *j = &fs.jstats;
+    printf("Journal: on, group commit every %d commands\n", fs.groupCommit);
+    printf("Commits: %llu\n", (unsigned long long)j->commits);
+    printf("Commands per Commit: %.1f\n", j->commits ? (double)j->ops / j->commits : 0.0);
+    printf("Fsyncs: %llu\n", (unsigned long long)j->fsyncs);
+    printf("Pages Logged: %llu\n", (unsigned long long)j->pages);
+    printf("Bytes Logged: %llu\n", (unsigned long long)j->bytes);
+    printf("Checkpoints: %llu\n", (unsigned long long)j->checkpoints);
+    printf("Records Replayed: %llu\n", (unsigned long long)j->replayed);
+    printf("Commit Time: %.3f ms\n", j->commitSeconds * 1e3);
+}
+
+/* create `count` small files in a new directory, one command each as far
+   as group commit is concerned, and report the rate and the journal's
+   share of the work */
+static void benchCmd(const char *dir, int count) {
+    FileNode *d = makeEntry(dir, true);
+    if (!d) return;
+    char path[PATH_LIMIT];
+    snprintf(path, sizeof(path), "%s", dirPath(d));
+    endCommand();
+
+    JournalStats before = fs.jstats;
+    double t0 = nowSeconds();
+    int made = 0;
+    for (; made < count; ++made) {
+        char name[PATH_LIMIT + 16];
+        snprintf(name, sizeof(name), "%s/f%d", path, made);
+        FileNode *f = makeEntry(name, false);
+        if (!f) break;
+        markDirty(f);
+        int err = writeAt(f, 0, "bench", 5);
+        if (err) { writeFailed(err, "Write"); break; }
+        endCommand();
+    }
+    journalCommit();
+    double secs = nowSeconds() - t0;
+
+    printf("Created %d files in %.3f s (%.0f files/s).\n", made, secs, secs > 0 ? made / secs : 0.0);
+    if (fs.journaling) {
+        printf("Journal: %llu commits, %llu fsyncs, %llu pages logged, %.3f ms committing.\n",
+               (unsigned long long)(fs.jstats.commits - before.commits),
+               (unsigned long long)(fs.jstats.fsyncs - before.fsyncs),
+               (unsigned long long)(fs.jstats.pages - before.pages),
+               (fs.jstats.commitSeconds - before.commitSeconds) * 1e3);
+    }
 }
 
 /* ---------- Init & Cleanup ---------- */
 
-static void initSystem(void) {
-    fs.freeHead = fs.freeTail = NULL;
-    fs.freeCount = 0;
-    for (int i = 0; i < TOTAL_BLOCKS; ++i) addFreeBlockTail(i);
+/* mount the image (NULL = in-memory only), formatting a new one with the
+   given geometry (0 = default); only the root node is built
+   here, everything below it loads as the tree is walked */
+static void initSystem(const char *imagePath, int blockSize, int totalBlocks) {
+    mountImage(imagePath, blockSize, totalBlocks);
 
-    fs.root = malloc(sizeof(FileNode));
-    if (!fs.root) die("malloc failed");
-    initFileNode(fs.root, "/", true);
+    fs.root = nodeFromInode(ROOT_INO);
     fs.root->parent = NULL;
     fs.root->child = NULL;
     fs.root->next = fs.root->prev = fs.root;
     fs.cwd = fs.root;
+    fs.pathGen = 1;
+    memset(fs.dcache, 0, sizeof(fs.dcache));
 }
 
 static void cleanup(void) {
-    /* free free-list */
-    FreeBlock *fb = fs.freeHead;
-    while (fb) {
-        FreeBlock *next = fb->next;
-        free(fb);
-        fb = next;
-    }
-    fs.freeHead = fs.freeTail = NULL;
-    fs.freeCount = 0;
-
     /* free filesystem tree */
     if (fs.root) {
+        syncMetadata();
         FileNode *child = fs.root->child;
         if (child) {
             FileNode *t = child;
@@ -376,19 +1954,75 @@ static void cleanup(void) {
                 t = next;
             } while (t != child);
         }
-        free(fs.root);
+        destroyNode(fs.root);
         fs.root = fs.cwd = NULL;
+        memset(fs.dcache, 0, sizeof(fs.dcache));
     }
+    if (fs.image) unmountImage();
+    free(fs.dedupIndex);
+    free(fs.dedupBuf);
+    fs.dedupIndex = NULL;
+    fs.dedupBuf = NULL;
+    free(fs.dirty);
+    fs.dirty = NULL;
+    fs.dirtyCap = 0;
 }
 
 /* ---------- Command parsing & main ---------- */
 
-int main(void) {
-    initSystem();
+/* byte count with an optional K/M/G/T suffix, 0 if malformed */
+static uint64_t parseSize(const char *s) {
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    int shift = 0;
+    switch (*end) {
+        case 'k': case 'K': shift = 10; break;
+        case 'm': case 'M': shift = 20; break;
+        case 'g': case 'G': shift = 30; break;
+        case 't': case 'T': shift = 40; break;
+        case '\0': break;
+        default: return 0;
+    }
+    if (shift && end[1] != '\0') return 0;
+    if (end == s || v > (UINT64_MAX >> shift)) return 0;
+    return (uint64_t)v << shift;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-b block_size] [-s disk_size] [-g group_commit] [-d] [image]\n"
+                    "  block_size: power of two from %d to %d bytes (default %d)\n"
+                    "  disk_size: bytes, K/M/G/T suffixes allowed (default %d blocks)\n"
+                    "  group_commit: commands per journal commit (default %d)\n"
+                    "  -d: share identical blocks (chosen when the image is formatted)\n",
+            prog, MIN_BLOCK_SIZE, MAX_BLOCK_SIZE, DEFAULT_BLOCK_SIZE, DEFAULT_TOTAL_BLOCKS,
+            DEFAULT_GROUP_COMMIT);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t blockSize = 0, diskSize = 0, group = DEFAULT_GROUP_COMMIT;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:s:g:d")) != -1) {
+        if (opt == 'd') { fs.dedup = true; continue; }
+        if (opt == 'b' && (blockSize = parseSize(optarg)) != 0) continue;
+        if (opt == 's' && (diskSize = parseSize(optarg)) != 0) continue;
+        if (opt == 'g' && (group = parseSize(optarg)) != 0 && group <= 1000000) continue;
+        usage(argv[0]);
+    }
+    fs.groupCommit = (int)group;
+    if (argc - optind > 1) usage(argv[0]);
+
+    /* geometry only matters when a new image is formatted */
+    uint64_t totalBlocks = 0;
+    if (diskSize) totalBlocks = diskSize / (blockSize ? blockSize : DEFAULT_BLOCK_SIZE);
+    if (!validGeometry(blockSize ? blockSize : DEFAULT_BLOCK_SIZE,
+                       diskSize ? totalBlocks : DEFAULT_TOTAL_BLOCKS)) usage(argv[0]);
+
+    initSystem(optind < argc ? argv[optind] : NULL, (int)blockSize, (int)totalBlocks);
     printf("Compact VFS - ready. Type 'exit' to quit.\n");
 
     char line[LINE_BUF];
-    char cmd[64], arg1[NAME_LIMIT + 2], argRest[LINE_BUF];
+    char cmd[64], arg1[PATH_LIMIT], argRest[LINE_BUF];
 
     while (1) {
         /* prompt: root shows '/' and others show their name */
@@ -401,7 +2035,7 @@ int main(void) {
 
         cmd[0] = arg1[0] = argRest[0] = '\0';
         /* parse with width limits; argRest captures remainder (data maybe with spaces) */
-        int scanned = sscanf(line, "%63s %50s %8191[^\n]", cmd, arg1, argRest);
+        int scanned = sscanf(line, "%63s %4095s %8191[^\n]", cmd, arg1, argRest);
 
         if (scanned <= 0) continue;
 
@@ -423,6 +2057,28 @@ int main(void) {
             if (scanned >= 2) readCmd(arg1);
             else printf("Usage: read <filename>\n");
         }
+        else if (strcmp(cmd, "pwrite") == 0) {
+            /* the data is everything after the offset and one space */
+            unsigned long long off;
+            int dataAt = 0;
+            if (scanned == 3 && sscanf(argRest, "%llu %n", &off, &dataAt) == 1 && argRest[dataAt])
+                pwriteCmd(arg1, off, argRest + dataAt);
+            else printf("Usage: pwrite <filename> <offset> <data...>\n");
+        }
+        else if (strcmp(cmd, "pread") == 0) {
+            unsigned long long off, len;
+            if (scanned == 3 && sscanf(argRest, "%llu %llu", &off, &len) == 2) preadCmd(arg1, off, len);
+            else printf("Usage: pread <filename> <offset> <length>\n");
+        }
+        else if (strcmp(cmd, "append") == 0) {
+            if (scanned == 3) appendCmd(arg1, argRest);
+            else printf("Usage: append <filename> <data...>\n");
+        }
+        else if (strcmp(cmd, "truncate") == 0) {
+            unsigned long long size;
+            if (scanned == 3 && sscanf(argRest, "%llu", &size) == 1) truncateCmd(arg1, size);
+            else printf("Usage: truncate <filename> <size>\n");
+        }
         else if (strcmp(cmd, "delete") == 0) {
             if (scanned >= 2) deleteCmd(arg1);
             else printf("Usage: delete <filename>\n");
@@ -431,16 +2087,31 @@ int main(void) {
             if (scanned >= 2) rmdirCmd(arg1);
             else printf("Usage: rmdir <dirname>\n");
         }
-        else if (strcmp(cmd, "ls") == 0) lsCmd();
+        else if (strcmp(cmd, "ls") == 0) lsCmd(scanned >= 2 ? arg1 : NULL);
+        else if (strcmp(cmd, "rename") == 0) {
+            char to[PATH_LIMIT];
+            if (scanned == 3 && sscanf(argRest, "%4095s", to) == 1) renameCmd(arg1, to);
+            else printf("Usage: rename <path> <newpath>\n");
+        }
         else if (strcmp(cmd, "cd") == 0) {
             if (scanned >= 2) cdCmd(arg1);
             else printf("Usage: cd <dirname|..>\n");
         }
         else if (strcmp(cmd, "pwd") == 0) { pwdCmd(fs.cwd); printf("\n"); }
         else if (strcmp(cmd, "df") == 0) dfCmd();
+        else if (strcmp(cmd, "sync") == 0) syncCmd();
+        else if (strcmp(cmd, "journal") == 0) journalCmd();
+        else if (strcmp(cmd, "bench") == 0) {
+            int count;
+            if (scanned == 3 && sscanf(argRest, "%d", &count) == 1 && count > 0) benchCmd(arg1, count);
+            else printf("Usage: bench <dirname> <count>\n");
+        }
         else if (strcmp(cmd, "exit") == 0) { cleanup(); printf("Memory released. Exiting program...\n"); break; }
         else printf("Invalid command.\n");
+
+        endCommand();
     }
 
+    if (fs.image) cleanup();
     return 0;
 }